@@ -0,0 +1,127 @@
+#include <util/delay.h>
+
+#include "hdlc.h"
+#include "uart.h"
+
+#define FLAG 0x7e
+#define FORMAT_TYPE 0xa0
+#define CLIENT_ADDRESS 0x21 /* Public client */
+#define SERVER_ADDRESS 0x03 /* Management logical device */
+
+/* Format (2), addresses (2) and control */
+#define HEADER_LENGTH 5
+/* Between the bytes of a frame */
+#define BYTE_TIMEOUT 50 /* ms */
+
+static uint16_t fcs_update(uint16_t fcs, uint8_t byte)
+{
+	fcs ^= byte;
+	for(uint8_t bit = 0; bit < 8; ++bit)
+	{
+		fcs = (fcs & 1) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+	}
+	return fcs;
+}
+
+static int16_t rx_byte(uint16_t timeout_ms)
+{
+	for(;;)
+	{
+		int16_t byte = uart_rx_noblock();
+		if(byte >= 0 || !timeout_ms--) return byte;
+		_delay_ms(1);
+	}
+}
+
+_Bool hdlc_rx(struct hdlc_frame *frame, uint16_t timeout_ms)
+{
+	int16_t byte;
+	do /* Skip anything before the opening flag */
+	{
+		byte = rx_byte(timeout_ms);
+		if(byte < 0) return false;
+	} while(byte != FLAG);
+
+	uint8_t header[HEADER_LENGTH];
+	uint16_t fcs = 0xffff;
+	for(uint8_t i = 0; i < HEADER_LENGTH; ++i)
+	{
+		if((byte = rx_byte(BYTE_TIMEOUT)) < 0) return false;
+		header[i] = byte;
+		fcs = fcs_update(fcs, byte);
+	}
+
+	uint16_t length = (uint16_t)(header[0] & 0x07) << 8 | header[1];
+	if((header[0] & 0xf8) != FORMAT_TYPE || header[2] != SERVER_ADDRESS || header[3] != CLIENT_ADDRESS ||
+	   length < HEADER_LENGTH + 2)
+		return false;
+
+	/* Everything after the header, except for the FCS and the closing flag */
+	uint16_t rest = length - HEADER_LENGTH - 2;
+	frame->control = header[4];
+	frame->length = 0;
+	if(rest)
+	{
+		/* HCS, then the information */
+		if(rest < 3 || rest - 2 > HDLC_MAX_INFO) return false;
+		for(uint8_t i = 0; i < 2; ++i)
+		{
+			if((byte = rx_byte(BYTE_TIMEOUT)) < 0) return false;
+			fcs = fcs_update(fcs, byte);
+		}
+		if(fcs != 0xf0b8) return false; /* The residue of a correct FCS */
+
+		frame->length = rest - 2;
+		for(uint8_t i = 0; i < frame->length; ++i)
+		{
+			if((byte = rx_byte(BYTE_TIMEOUT)) < 0) return false;
+			frame->info[i] = byte;
+			fcs = fcs_update(fcs, byte);
+		}
+	}
+
+	for(uint8_t i = 0; i < 2; ++i)
+	{
+		if((byte = rx_byte(BYTE_TIMEOUT)) < 0) return false;
+		fcs = fcs_update(fcs, byte);
+	}
+
+	return fcs == 0xf0b8 && rx_byte(BYTE_TIMEOUT) == FLAG;
+}
+
+static void tx_fcs(uint16_t fcs)
+{
+	fcs = ~fcs;
+	uart_tx(fcs & 0xff);
+	uart_tx(fcs >> 8);
+}
+
+void hdlc_tx(uint8_t control, uint8_t const *info, uint8_t length)
+{
+	uint16_t frame_length = HEADER_LENGTH + 2 + (length ? 2 + length : 0);
+	uint8_t const header[HEADER_LENGTH] = {FORMAT_TYPE | frame_length >> 8, frame_length & 0xff, CLIENT_ADDRESS,
+	                                       SERVER_ADDRESS, control};
+
+	uint16_t fcs = 0xffff;
+	uart_tx(FLAG);
+	for(uint8_t i = 0; i < HEADER_LENGTH; ++i)
+	{
+		uart_tx(header[i]);
+		fcs = fcs_update(fcs, header[i]);
+	}
+
+	if(length)
+	{
+		tx_fcs(fcs); /* HCS */
+		uint16_t hcs = ~fcs;
+		fcs = fcs_update(fcs_update(fcs, hcs & 0xff), hcs >> 8);
+		for(uint8_t i = 0; i < length; ++i)
+		{
+			uart_tx(info[i]);
+			fcs = fcs_update(fcs, info[i]);
+		}
+	}
+
+	tx_fcs(fcs);
+	uart_tx(FLAG);
+}
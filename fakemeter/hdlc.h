@@ -0,0 +1,34 @@
+#ifndef FAKEMETER_HDLC_H
+#define FAKEMETER_HDLC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* HDLC frames of protocol mode E (IEC 62056-46): frame format type 3, one byte addresses,
+ * no segmentation. Information frames start with the LLC header. */
+
+#define HDLC_SNRM 0x93
+#define HDLC_UA 0x73
+#define HDLC_DISC 0x53
+#define HDLC_DM 0x1f
+
+#define HDLC_MAX_INFO 128
+
+struct hdlc_frame
+{
+	uint8_t control;
+	uint8_t length; /* Of the information */
+	uint8_t info[HDLC_MAX_INFO];
+};
+
+static inline uint8_t hdlc_info_control(uint8_t send_seq, uint8_t recv_seq)
+{
+	return (recv_seq & 0x07) << 5 | 0x10 | (send_seq & 0x07) << 1;
+}
+
+/* Receives a frame addressed to us. Returns false if none arrived within the timeout
+ * or it was malformed. */
+_Bool hdlc_rx(struct hdlc_frame *frame, uint16_t timeout_ms);
+void hdlc_tx(uint8_t control, uint8_t const *info, uint8_t length);
+
+#endif
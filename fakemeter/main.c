@@ -8,6 +8,7 @@
 #include <util/delay.h>
 
 #include "dl.h"
+#include "hdlc.h"
 #include "uart.h"
 
 /* Must be 3 characters */
@@ -21,7 +22,14 @@
 // #define USE_MODE_B
 // #define USE_MODE_A
 
+/* Uncomment to also offer protocol mode E (HDLC, DLMS/COSEM) along with mode C */
+// #define USE_MODE_E
+
+#if defined(USE_MODE_E)
+#define IDENTIFICATION "/" MANUFACTURER BAUD_ID "\\2" PRODUCT "\r\n"
+#else
 #define IDENTIFICATION "/" MANUFACTURER BAUD_ID PRODUCT "\r\n"
+#endif
 
 struct baud_setting
 {
@@ -142,6 +150,136 @@ void tx_object(struct object const *obj)
 #define ETX "\x03"
 #define DATASET_END "!\r\n" ETX
 
+#if defined(USE_MODE_E)
+/* Registers (class 3) in mode E, values are sent as double-long-unsigned with the scaler
+ * taken from the number of decimals and no unit */
+#define REGISTER_CLASS 3
+#define NO_UNIT 255
+
+/* Accepts any association without authentication */
+static uint8_t const AARE[] = {0x61, 0x29, 0xa1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01,
+                               0x01, 0xa2, 0x03, 0x02, 0x01, 0x00, 0xa3, 0x05, 0xa1, 0x03, 0x02, 0x01,
+                               0x00, 0xbe, 0x10, 0x04, 0x0e, 0x08, 0x00, 0x06, 0x5f, 0x1f, 0x04, 0x00,
+                               0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x07};
+
+/* Finds the object with the logical name 1-0:C.D.E*255 */
+static struct object const *find_object(uint8_t const *ln)
+{
+	if(ln[0] != 1 || ln[1] != 0 || ln[5] != 255) return 0;
+
+	for(struct object const *obj = objects; obj->obis_code; ++obj)
+	{
+		char code[12];
+		snprintf(code, sizeof(code), "%u.%u.%u", ln[2], ln[3], ln[4]);
+		if(!strcmp(code, obj->obis_code)) return obj;
+	}
+	return 0;
+}
+
+/* Converts a value such as "0012.34" to 1234 with 2 decimals */
+static uint32_t parse_value(char const *value, uint8_t *decimals)
+{
+	uint32_t result = 0;
+	_Bool fraction = false;
+	*decimals = 0;
+	for(; *value; ++value)
+	{
+		if(*value == '.')
+		{
+			fraction = true;
+			continue;
+		}
+		result = result * 10 + (*value - '0');
+		if(fraction) ++*decimals;
+	}
+	return result;
+}
+
+/* Answers an APDU, returns the length of the response */
+static uint8_t handle_apdu(uint8_t const *apdu, uint8_t length, uint8_t *response)
+{
+	if(length >= 1 && apdu[0] == 0x60) /* AARQ */
+	{
+		memcpy(response, AARE, sizeof(AARE));
+		return sizeof(AARE);
+	}
+
+	/* GET.request.normal: tag, type, invoke id, class (2), logical name (6), attribute, access selection */
+	if(length < 13 || apdu[0] != 0xc0 || apdu[1] != 0x01) return 0;
+
+	response[0] = 0xc4; /* GET.response.normal */
+	response[1] = 0x01;
+	response[2] = apdu[2];
+
+	struct object const *obj = find_object(&apdu[5]);
+	uint16_t class_id = (uint16_t)apdu[3] << 8 | apdu[4];
+	uint8_t attribute = apdu[11];
+	if(!obj || class_id != REGISTER_CLASS || (attribute != 2 && attribute != 3))
+	{
+		response[3] = 0x01; /* Data access result */
+		response[4] = 0x04; /* Object undefined */
+		return 5;
+	}
+
+	char text[MAX_VALUE_LENGTH];
+	uint8_t decimals;
+	obj->formatter(text, obj->user_data);
+	uint32_t value = parse_value(text, &decimals);
+
+	response[3] = 0x00; /* Data */
+	if(attribute == 3) /* scaler_unit */
+	{
+		uint8_t const scaler_unit[] = {0x02, 0x02, 0x0f, (uint8_t)-decimals, 0x16, NO_UNIT};
+		memcpy(&response[4], scaler_unit, sizeof(scaler_unit));
+		return 4 + sizeof(scaler_unit);
+	}
+
+	response[4] = 0x06; /* double-long-unsigned */
+	for(uint8_t i = 0; i < 4; ++i)
+	{
+		response[5 + i] = value >> (24 - 8 * i);
+	}
+	return 9;
+}
+
+/* Serves an HDLC connection until the client disconnects or goes quiet */
+static void mode_e_session(void)
+{
+	static struct hdlc_frame frame;
+	static uint8_t response[HDLC_MAX_INFO];
+	_Bool connected = false;
+	uint8_t send_seq = 0, recv_seq = 0;
+
+	while(hdlc_rx(&frame, RECEIVE_TIMEOUT))
+	{
+		if(frame.control == HDLC_SNRM)
+		{
+			connected = true;
+			send_seq = recv_seq = 0;
+			hdlc_tx(HDLC_UA, 0, 0);
+		}
+		else if(frame.control == HDLC_DISC)
+		{
+			hdlc_tx(connected ? HDLC_UA : HDLC_DM, 0, 0);
+			return;
+		}
+		else if(connected && !(frame.control & 0x01) && frame.length >= 3) /* Information, with LLC header */
+		{
+			recv_seq = (recv_seq + 1) & 0x07;
+			response[0] = 0xe6;
+			response[1] = 0xe7;
+			response[2] = 0x00;
+			uint8_t length = handle_apdu(&frame.info[3], frame.length - 3, &response[3]);
+			if(length) hdlc_tx(hdlc_info_control(send_seq++, recv_seq), response, 3 + length);
+		}
+		else
+		{
+			hdlc_tx(HDLC_DM, 0, 0);
+		}
+	}
+}
+#endif
+
 #define ERR_LED_FLASHES 5
 #define ERR_LED_FLASH_DURATION 100 /* ms */
 
@@ -175,12 +313,12 @@ int main(void)
 {
 	err_led_setup();
 
-	/* 7E1, transmit enabled */
+	/* Transmit enabled */
 	UCSR0B = (1 << TXEN0);
-	UCSR0C = (1 << UPM01) | (1 << UCSZ01);
 
 	for(;;)
 	{
+		UCSR0C = (1 << UPM01) | (1 << UCSZ01); /* 7E1 */
 		uint8_t opening_idx = 0;
 		uint16_t countdown = RECEIVE_TIMEOUT;
 
@@ -225,6 +363,9 @@ int main(void)
 		countdown = RECEIVE_TIMEOUT;
 		uint8_t vzy[3];
 		uint8_t read_idx = 0;
+#if defined(USE_MODE_E)
+		_Bool mode_e = false;
+#endif
 
 		/* Read option select message for protocol mode C.
 		 * The complete message must be received within the timeout. */
@@ -257,7 +398,12 @@ int main(void)
 
 			if(read_idx == 6)
 			{
-				/* Only data readout mode (V=Y=0) is supported */
+#if defined(USE_MODE_E)
+				/* HDLC protocol procedure (V=2) in binary mode (Y=2) */
+				mode_e = vzy[0] == '2' && vzy[2] == '2';
+				if(mode_e && set_baud(vzy[1])) break;
+#endif
+				/* Only data readout mode (V=Y=0) is supported otherwise */
 				if(vzy[0] != '0' || !set_baud(vzy[1]) || vzy[2] != '0')
 				{
 					err();
@@ -269,6 +415,15 @@ int main(void)
 
 		/* Only transmit the dataset if a full option select message was read, or none at all */
 		if(read_idx != 0 && read_idx != 6) continue;
+
+#if defined(USE_MODE_E)
+		if(mode_e)
+		{
+			UCSR0C = (1 << UCSZ01) | (1 << UCSZ00); /* 8N1 */
+			mode_e_session();
+			continue;
+		}
+#endif
 #elif defined(USE_MODE_B)
 		_delay_ms(66);
 		set_baud(BAUD_ID[0]); /* Just change baud without requiring an acknowledgement */
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <ctime>
+
+#include <Arduino.h>
+#include <sys/time.h>
+
+#include "align.h"
+#include "config.h"
+#include "logger.h"
+
+namespace align
+{
+#ifdef ALIGNED_READ_INTERVAL
+/* Before this, the clock hasn't been set by NTP yet */
+time_t const MIN_VALID_TIME = 1600000000;
+/* start() busy-waits for at most this long, it's woken up a millisecond early */
+int64_t const MAX_SPIN_US = 2000;
+
+static uint64_t last_slot_us;   /* Wall clock, 0 before the first aligned readout */
+static uint64_t start_us;       /* Wall clock at which the planned readout starts */
+static uint32_t start_micros;   /* The same in micros(), once it's about to start */
+static uint32_t started_micros; /* micros() at which it actually started */
+static bool planned, running;
+static int32_t lead_us;
+static bool have_phase_error;
+#endif
+
+static Stats stats_;
+
+#ifdef ALIGNED_READ_INTERVAL
+static bool wall_clock_us(uint64_t &now_us)
+{
+	struct timeval tv;
+	gettimeofday(&tv, nullptr);
+	if(tv.tv_sec < MIN_VALID_TIME) return false;
+
+	now_us = static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+	return true;
+}
+#endif
+
+void begin()
+{
+#ifdef ALIGNED_READ_INTERVAL
+	configTime(0, 0, NTP_SERVER);
+#endif
+}
+
+uint32_t delay_until_slot(uint32_t earliest_ms)
+{
+#ifdef ALIGNED_READ_INTERVAL
+	uint64_t const interval_us = static_cast<uint64_t>(ALIGNED_READ_INTERVAL) * 1000;
+	uint64_t now_us;
+	planned = false;
+	if(!wall_clock_us(now_us)) return earliest_ms;
+
+	/* The first slot whose readout can still start after earliest_ms */
+	uint64_t earliest_start_us = now_us + static_cast<uint64_t>(earliest_ms) * 1000 + lead_us;
+	uint64_t slot_us = (earliest_start_us + interval_us - 1) / interval_us * interval_us;
+
+	/* Count the slots since the last one that passed because we were too late for them,
+	 * not the ones left out on purpose (READ_DELAY, refresh intervals) */
+	if(last_slot_us && last_slot_us < slot_us)
+	{
+		uint64_t reachable_us = now_us + lead_us;
+		uint64_t next_us = last_slot_us + interval_us;
+		if(next_us < reachable_us && next_us < slot_us)
+		{
+			uint32_t late = (std::min(reachable_us, slot_us) - next_us + interval_us - 1) / interval_us;
+			stats_.slots_skipped += late;
+			logger::warn("readout took too long, skipping %" PRIu32 " slot(s)", late);
+		}
+	}
+
+	/* In 64 bits: with intervals longer than about 71 minutes, the delay overflows micros() */
+	start_us = slot_us - lead_us;
+	uint32_t delay_ms = (start_us - now_us) / 1000;
+	last_slot_us = slot_us;
+	planned = true;
+
+	/* Wake up a millisecond early, start() waits for the rest */
+	return delay_ms > 0 ? delay_ms - 1 : 0;
+#else
+	return earliest_ms;
+#endif
+}
+
+bool start()
+{
+#ifdef ALIGNED_READ_INTERVAL
+	uint64_t now_us;
+	running = planned && wall_clock_us(now_us);
+	planned = false;
+	if(!running) return true;
+
+	int64_t remaining_us = static_cast<int64_t>(start_us - now_us);
+	if(remaining_us < -static_cast<int64_t>(ALIGNED_READ_TOLERANCE * 1000))
+	{
+		++stats_.slots_skipped;
+		running = false;
+		logger::warn("started %" PRIi32 " ms late, skipping the slot", static_cast<int32_t>(-remaining_us / 1000));
+		return false;
+	}
+	if(remaining_us > MAX_SPIN_US)
+	{
+		/* Woken up too early (the clock was stepped, or the scheduler ran us early): plan
+		 * the same slot again rather than spin for long */
+		running = false;
+		return false;
+	}
+	start_micros = micros() + static_cast<int32_t>(remaining_us); /* At most MAX_SPIN_US from now */
+
+	/* Busy-wait for the rest of the early wake-up */
+	while(static_cast<int32_t>(start_micros - micros()) > 0)
+	{
+	}
+	started_micros = micros();
+#endif
+	return true;
+}
+
+void completed(uint32_t first_byte_us)
+{
+#ifdef ALIGNED_READ_INTERVAL
+	if(!running) return;
+	running = false;
+
+	/* The slot boundary in micros() terms is where the planned start plus the lead was */
+	int32_t phase_error = static_cast<int32_t>(first_byte_us - (start_micros + lead_us));
+	if(have_phase_error)
+	{
+		/* Like the interarrival jitter of RTP (RFC 3550) */
+		uint32_t change = std::abs(phase_error - stats_.phase_error_us);
+		stats_.jitter_us += (static_cast<int32_t>(change) - static_cast<int32_t>(stats_.jitter_us)) / 16;
+	}
+	stats_.phase_error_us = phase_error;
+	have_phase_error = true;
+
+	/* Follow changes of the meter's response time gradually */
+	int32_t measured_lead = static_cast<int32_t>(first_byte_us - started_micros);
+	lead_us = lead_us ? lead_us + (measured_lead - lead_us) / 4 : measured_lead;
+	stats_.lead_us = lead_us;
+#else
+	(void)first_byte_us;
+#endif
+}
+
+Stats const &stats()
+{
+	return stats_;
+}
+}
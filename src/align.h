@@ -0,0 +1,40 @@
+#ifndef IEC62056_MQTT_ALIGN_H
+#define IEC62056_MQTT_ALIGN_H
+
+#include <cstdint>
+
+/* Starts readouts on wall-clock boundaries (multiples of ALIGNED_READ_INTERVAL since the
+ * epoch, from NTP), so that samples taken by several devices line up. Readouts start early
+ * by the measured time it takes until the meter sends its data block, which is the moment
+ * that is aligned. Slots that can't be made are skipped rather than shifting the schedule.
+ * Without ALIGNED_READ_INTERVAL, or until the clock is set, readouts aren't aligned. */
+namespace align
+{
+struct Stats
+{
+	uint32_t slots_skipped;  /* Because the previous readout or the start was late */
+	int32_t phase_error_us;  /* Data block start minus slot boundary, last aligned readout */
+	uint32_t jitter_us;      /* Smoothed change of the phase error between readouts */
+	uint32_t lead_us;        /* How early readouts are started */
+};
+
+/* Start synchronizing the clock */
+void begin();
+
+/* How long to wait before starting the readout for the first slot that can be made when
+ * waiting at least earliest_ms. Returns earliest_ms if readouts aren't aligned. */
+uint32_t delay_until_slot(uint32_t earliest_ms);
+
+/* Called when it's time to start the readout planned with delay_until_slot() (a bit
+ * early): waits for the exact start time. Returns false if the slot was missed, in
+ * which case it's skipped, or if it's still too far off to wait for, in which case the
+ * caller plans it again. Readouts that weren't planned can always start. */
+bool start();
+
+/* Record when the data block of a successful readout started (micros()) */
+void completed(uint32_t first_byte_us);
+
+Stats const &stats();
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include <cstring>
+
+#include "capture.h"
+
+static size_t const MAX_VARINT_LENGTH = 5; /* For 32-bit values */
+
+void Capture::clear(uint32_t timestamp_us)
+{
+	if(frozen_) return;
+
+	memcpy(buffer_, "IECC", 4);
+	buffer_[4] = VERSION;
+	buffer_[5] = 0;
+	size_ = HEADER_LENGTH;
+	last_timestamp_us_ = timestamp_us;
+}
+
+void Capture::put_varint(uint32_t value)
+{
+	while(value >= 0x80)
+	{
+		buffer_[size_++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buffer_[size_++] = value;
+}
+
+void Capture::put(uint8_t const *data, size_t length)
+{
+	memcpy(&buffer_[size_], data, length);
+	size_ += length;
+}
+
+/* Writes the record header if the whole record will fit, sets the truncated flag otherwise */
+bool Capture::begin_record(Record type, size_t payload_length, uint32_t timestamp_us)
+{
+	if(frozen_ || (buffer_[5] & FLAG_TRUNCATED)) return false;
+
+	if(size_ + 1 + MAX_VARINT_LENGTH + payload_length > capacity_)
+	{
+		buffer_[5] |= FLAG_TRUNCATED;
+		return false;
+	}
+
+	buffer_[size_++] = static_cast<uint8_t>(type);
+	put_varint(timestamp_us - last_timestamp_us_);
+	last_timestamp_us_ = timestamp_us;
+	return true;
+}
+
+void Capture::record_rx(uint8_t const *data, size_t length, uint32_t timestamp_us)
+{
+	if(!begin_record(Record::Rx, MAX_VARINT_LENGTH + length, timestamp_us)) return;
+
+	put_varint(length);
+	put(data, length);
+}
+
+void Capture::record_tx(uint8_t const *data, size_t length, uint32_t timestamp_us)
+{
+	if(!begin_record(Record::Tx, MAX_VARINT_LENGTH + length, timestamp_us)) return;
+
+	put_varint(length);
+	put(data, length);
+}
+
+void Capture::record_baud(uint32_t baud, uint8_t config, uint8_t mode, uint32_t timestamp_us)
+{
+	if(!begin_record(Record::Baud, MAX_VARINT_LENGTH + 2, timestamp_us)) return;
+
+	put_varint(baud);
+	buffer_[size_++] = config;
+	buffer_[size_++] = mode;
+}
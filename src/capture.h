@@ -0,0 +1,58 @@
+#ifndef IEC62056_MQTT_CAPTURE_H
+#define IEC62056_MQTT_CAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* Records the raw serial traffic of a readout into a caller-provided buffer.
+ *
+ * Format: the magic "IECC", a version byte (1) and a flags byte (bit 0: truncated),
+ * followed by records. Every record starts with its type byte and the time since the
+ * previous record (or the start of the capture) in us as a varint, then:
+ *   Rx, Tx: length (varint) and the bytes themselves
+ *   Baud:   baud rate (varint), serial config (byte, as passed to HardwareSerial::begin)
+ *           and serial mode (byte)
+ * Varints are unsigned LEB128: 7 bits per byte, least significant group first, the top
+ * bit set on all bytes but the last. */
+class Capture
+{
+public:
+	enum class Record : uint8_t
+	{
+		Rx,
+		Tx,
+		Baud,
+	};
+
+	static uint8_t const VERSION = 1;
+	static uint8_t const FLAG_TRUNCATED = 0x01;
+	static size_t const HEADER_LENGTH = 6;
+
+	Capture(uint8_t *buffer, size_t size) : buffer_(buffer), capacity_(size) { clear(0); }
+
+	/* Throw away the captured data and start a new capture at the given time, unless frozen */
+	void clear(uint32_t timestamp_us);
+	/* A frozen capture is kept as it is until it's unfrozen */
+	void freeze() { frozen_ = true; }
+	void unfreeze() { frozen_ = false; }
+	bool frozen() const { return frozen_; }
+
+	void record_rx(uint8_t const *data, size_t length, uint32_t timestamp_us);
+	void record_tx(uint8_t const *data, size_t length, uint32_t timestamp_us);
+	void record_baud(uint32_t baud, uint8_t config, uint8_t mode, uint32_t timestamp_us);
+
+	uint8_t const *data() const { return buffer_; }
+	size_t size() const { return size_; }
+
+private:
+	bool begin_record(Record type, size_t payload_length, uint32_t timestamp_us);
+	void put_varint(uint32_t value);
+	void put(uint8_t const *data, size_t length);
+
+	uint8_t *buffer_;
+	size_t capacity_, size_ = 0;
+	uint32_t last_timestamp_us_ = 0;
+	bool frozen_ = false;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "config.h"
+#include "connection.h"
+#include "logger.h"
+
+#ifdef FAST_BOOT
+#include <coredecls.h> /* crc32() */
+
+/* What's needed to reconnect without scanning and DHCP, kept in RTC memory across resets */
+struct WifiCache
+{
+	uint32_t crc;
+	uint32_t ip, gateway, subnet, dns;
+	uint8_t bssid[6];
+	uint8_t channel;
+	uint8_t uses; /* Connections made with the cache since it was saved */
+};
+
+static_assert(sizeof(WifiCache) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+
+/* Offset in RTC user memory, in 4 byte blocks */
+uint32_t const WIFI_CACHE_OFFSET = 0;
+
+static uint32_t wifi_cache_crc(WifiCache const &cache)
+{
+	return crc32(&cache.ip, sizeof(cache) - sizeof(cache.crc));
+}
+
+/* Try to connect using the cached access point and IP configuration */
+bool ConnectionManager::begin_wifi_cached()
+{
+	WifiCache cache;
+	if(!ESP.rtcUserMemoryRead(WIFI_CACHE_OFFSET, reinterpret_cast<uint32_t *>(&cache), sizeof(cache)) ||
+	   cache.crc != wifi_cache_crc(cache) || cache.uses >= FAST_BOOT_MAX_USES)
+		return false;
+
+	++cache.uses;
+	cache.crc = wifi_cache_crc(cache);
+	ESP.rtcUserMemoryWrite(WIFI_CACHE_OFFSET, reinterpret_cast<uint32_t *>(&cache), sizeof(cache));
+
+	WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+	WiFi.begin(WIFI_SSID, WIFI_PASS, cache.channel, cache.bssid);
+	return true;
+}
+
+void ConnectionManager::save_wifi_cache()
+{
+	WifiCache cache = {};
+	cache.ip = WiFi.localIP();
+	cache.gateway = WiFi.gatewayIP();
+	cache.subnet = WiFi.subnetMask();
+	cache.dns = WiFi.dnsIP();
+	memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+	cache.channel = WiFi.channel();
+	cache.crc = wifi_cache_crc(cache);
+
+	ESP.rtcUserMemoryWrite(WIFI_CACHE_OFFSET, reinterpret_cast<uint32_t *>(&cache), sizeof(cache));
+}
+
+/* Drop the cache and reconnect with a scan and DHCP */
+void ConnectionManager::renew_wifi()
+{
+	uint32_t invalid = 0;
+	ESP.rtcUserMemoryWrite(WIFI_CACHE_OFFSET, &invalid, sizeof(invalid));
+	mqtt_.disconnect();
+	WiFi.disconnect();
+	WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); /* Back to DHCP */
+	begin_wifi();
+}
+#endif
+
+void ConnectionManager::begin_wifi()
+{
+#ifdef FAST_BOOT
+	using_cache_ = begin_wifi_cached();
+	if(!using_cache_)
+#endif
+		WiFi.begin(WIFI_SSID, WIFI_PASS);
+
+	wifi_begin_ = millis();
+#ifdef FAST_BOOT
+	cache_since_ = wifi_begin_;
+#endif
+}
+
+void ConnectionManager::begin()
+{
+	WiFi.persistent(false); /* Don't write the credentials to flash on every boot */
+	WiFi.mode(WIFI_STA);
+	WiFi.hostname(DEVICE_NAME);
+	WiFi.setAutoReconnect(true);
+	begin_wifi();
+
+	/* Bound the time a single connection attempt can block */
+	mqtt_.setSocketTimeout((MQTT_CONNECT_TIMEOUT + 999) / 1000);
+
+	disconnected_since_ = wifi_begin_;
+	state_ = State::WifiConnecting;
+}
+
+void ConnectionManager::change_state(State to)
+{
+	if(to == state_) return;
+
+	++transitions_;
+	state_ = to;
+}
+
+void ConnectionManager::back_off()
+{
+	backoff_ = backoff_ ? backoff_ * 2 : RECONNECT_BACKOFF_MIN;
+	if(backoff_ > RECONNECT_BACKOFF_MAX) backoff_ = RECONNECT_BACKOFF_MAX;
+
+	/* Wait somewhere between half and all of the backoff, so that devices that lost their
+	 * connection at the same time don't all retry at the same time */
+	uint32_t wait = backoff_ / 2 + random(backoff_ / 2 + 1);
+	backoff_until_ = millis() + wait;
+	change_state(State::Backoff);
+}
+
+void ConnectionManager::connect_mqtt()
+{
+	if(!mqtt_.connect("", MQTT_TOPIC_PREFIX "status/LWT", 1, true, "Offline"))
+	{
+		logger::debug("mqtt connect failed: %d", mqtt_.state());
+		return back_off();
+	}
+
+	backoff_ = 0;
+	reconnect_time_ = millis() - disconnected_since_;
+	change_state(State::Connected);
+
+	mqtt_.publish(MQTT_TOPIC_PREFIX "status/LWT", "Online", true);
+	on_connected_();
+}
+
+void ConnectionManager::loop()
+{
+	uint32_t now = millis();
+
+	/* WiFi can come up in any state, the SDK reconnects on its own */
+	bool wifi_connected = WiFi.isConnected();
+	if(wifi_connected && !wifi_connected_) on_wifi_connected_();
+	wifi_connected_ = wifi_connected;
+
+#ifdef FAST_BOOT
+	/* The cached address isn't leased, don't keep using it for longer than a lease */
+	if(using_cache_ && now - cache_since_ >= FAST_BOOT_LIFETIME)
+	{
+		logger::info("renewing the cached wifi configuration");
+		renew_wifi();
+		disconnected_since_ = wifi_begin_;
+		return change_state(State::WifiConnecting);
+	}
+#endif
+
+	switch(state_)
+	{
+		case State::WifiConnecting:
+			if(WiFi.isConnected())
+			{
+#ifdef FAST_BOOT
+				if(!using_cache_) save_wifi_cache(); /* Otherwise it's still there, counting its uses */
+#endif
+				change_state(State::MqttConnecting);
+			}
+#ifdef FAST_BOOT
+			else if(using_cache_ && now - wifi_begin_ >= FAST_BOOT_CONNECT_TIMEOUT)
+			{
+				/* The access point or the network configuration might have changed, drop the
+				 * cache and connect normally straight away */
+				logger::debug("cached wifi connection failed");
+				renew_wifi();
+			}
+#endif
+			else if(now - wifi_begin_ >= WIFI_CONNECT_TIMEOUT)
+			{
+				back_off();
+			}
+			break;
+		case State::MqttConnecting:
+			if(!WiFi.isConnected()) return change_state(State::WifiConnecting);
+			connect_mqtt();
+			break;
+		case State::Connected:
+			if(mqtt_.loop()) break; /* PubSubClient::loop() returns false if not connected */
+
+			logger::debug("connection lost");
+			disconnected_since_ = wifi_begin_ = now; /* The SDK reconnects to WiFi on its own */
+			change_state(WiFi.isConnected() ? State::MqttConnecting : State::WifiConnecting);
+			break;
+		case State::Backoff:
+			if(static_cast<int32_t>(now - backoff_until_) < 0) break;
+
+			if(WiFi.isConnected())
+			{
+				change_state(State::MqttConnecting);
+			}
+			else
+			{
+				/* The SDK keeps retrying on its own, but start over in case it got stuck */
+				WiFi.disconnect();
+				begin_wifi();
+				change_state(State::WifiConnecting);
+			}
+			break;
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef IEC62056_MQTT_CONNECTION_H
+#define IEC62056_MQTT_CONNECTION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <PubSubClient.h>
+
+#include "config.h"
+
+/* Keeps the WiFi and MQTT connections up without blocking for long. Failed attempts
+ * are retried with a jittered exponential backoff. */
+class ConnectionManager
+{
+public:
+	enum class State : uint8_t
+	{
+		WifiConnecting,
+		MqttConnecting,
+		Connected,
+		Backoff,
+	};
+
+	/* on_wifi_connected is called every time WiFi comes up, on_connected every time the MQTT
+	 * connection is (re)established */
+	ConnectionManager(PubSubClient &mqtt, void (*on_wifi_connected)(), void (*on_connected)())
+	    : mqtt_(mqtt), on_wifi_connected_(on_wifi_connected), on_connected_(on_connected)
+	{}
+	ConnectionManager(ConnectionManager const &) = delete;
+	ConnectionManager(ConnectionManager &&) = delete;
+
+	/* Start connecting to WiFi */
+	void begin();
+	/* Must be called frequently to advance the state machine and service the MQTT client */
+	void loop();
+
+	State state() const { return state_; }
+	bool connected() const { return state_ == State::Connected; }
+	size_t transitions() const { return transitions_; }
+	/* How long it took to get connected the last time, measured from the loss of the
+	 * connection (or begin()) */
+	uint32_t reconnect_time() const { return reconnect_time_; }
+
+private:
+	void change_state(State to);
+	void connect_mqtt();
+	void back_off();
+	void begin_wifi();
+#ifdef FAST_BOOT
+	bool begin_wifi_cached();
+	void save_wifi_cache();
+	void renew_wifi();
+#endif
+
+	PubSubClient &mqtt_;
+	void (*on_wifi_connected_)();
+	void (*on_connected_)();
+	bool wifi_connected_ = false;
+	State state_ = State::WifiConnecting;
+	uint32_t disconnected_since_ = 0;
+	uint32_t wifi_begin_ = 0; /* millis() of the last (re)start of the WiFi connection */
+	uint32_t backoff_ = 0, backoff_until_ = 0;
+	size_t transitions_ = 0;
+	uint32_t reconnect_time_ = 0;
+#ifdef FAST_BOOT
+	bool using_cache_ = false; /* The current WiFi connection attempt uses the RTC cache */
+	uint32_t cache_since_ = 0;
+#endif
+};
+
+#endif
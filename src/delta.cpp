@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <optional>
+#include <string_view>
+
+#include "config.h"
+#include "delta.h"
+#include "fixed.h"
+
+namespace delta
+{
+#ifdef DELTA_OBJECTS
+static char const *const OBJECTS[] = {DELTA_OBJECTS};
+size_t const COUNT = sizeof(OBJECTS) / sizeof(OBJECTS[0]);
+#else
+static char const *const *const OBJECTS = nullptr;
+size_t const COUNT = 0;
+#endif
+
+enum class FrameType : uint8_t
+{
+	Keyframe,
+	Delta,
+};
+
+size_t const MAX_VARINT_LENGTH = 10; /* 64 bits */
+size_t const MAX_FRAME_LENGTH = 1 + MAX_VARINT_LENGTH + COUNT * (1 + MAX_VARINT_LENGTH);
+
+struct State
+{
+	int64_t value; /* In units of the last decimal */
+	uint8_t decimals;
+};
+
+static State states[COUNT ? COUNT : 1];
+static uint8_t buffer[MAX_FRAME_LENGTH];
+static uint32_t sequence;
+static uint32_t frames_since_keyframe;
+static bool keyframe_requested = true;
+
+size_t count()
+{
+	return COUNT;
+}
+
+char const *obis(size_t index)
+{
+	return OBJECTS[index];
+}
+
+bool includes(std::string const &obis)
+{
+	for(size_t i = 0; i < COUNT; ++i)
+	{
+		if(obis == OBJECTS[i]) return true;
+	}
+	return false;
+}
+
+void request_keyframe()
+{
+	keyframe_requested = true;
+}
+
+uint8_t const *frame()
+{
+	return buffer;
+}
+
+/* Number of decimals in a value such as "-0012.345*kW", at most FIXED_DECIMALS. Like
+ * parse_fixed(), accepts ',' as the decimal separator too. */
+static uint8_t decimals(std::string_view text)
+{
+	text = text.substr(0, text.find('*'));
+	size_t point = text.find_first_of(".,");
+	if(point == std::string_view::npos) return 0;
+
+	return std::min<size_t>(text.size() - point - 1, FIXED_DECIMALS);
+}
+
+static int64_t const POWERS_OF_TEN[FIXED_DECIMALS + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+static size_t put_varint(uint8_t *out, uint64_t value)
+{
+	size_t len = 0;
+	while(value >= 0x80)
+	{
+		out[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	out[len++] = value;
+	return len;
+}
+
+static size_t put_zigzag(uint8_t *out, int64_t value)
+{
+	return put_varint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+size_t encode(Values const &values)
+{
+	if(!COUNT) return 0; /* Nothing to publish */
+
+	State current[COUNT ? COUNT : 1];
+	bool keyframe = keyframe_requested || frames_since_keyframe + 1 >= DELTA_KEYFRAME_INTERVAL;
+	for(size_t i = 0; i < COUNT; ++i)
+	{
+		auto entry = values.find(OBJECTS[i]);
+		if(entry == values.end()) return 0;
+		std::optional<Fixed> value = parse_fixed(entry->second);
+		if(!value) return 0;
+
+		current[i].decimals = decimals(entry->second);
+		current[i].value = *value / POWERS_OF_TEN[FIXED_DECIMALS - current[i].decimals];
+		if(current[i].decimals != states[i].decimals) keyframe = true; /* The deltas' unit changed */
+	}
+
+	size_t len = 0;
+	buffer[len++] = static_cast<uint8_t>(keyframe ? FrameType::Keyframe : FrameType::Delta);
+	len += put_varint(&buffer[len], sequence++);
+	for(size_t i = 0; i < COUNT; ++i)
+	{
+		if(keyframe)
+		{
+			buffer[len++] = current[i].decimals;
+			len += put_zigzag(&buffer[len], current[i].value);
+		}
+		else
+		{
+			len += put_zigzag(&buffer[len], current[i].value - states[i].value);
+		}
+		states[i] = current[i];
+	}
+
+	frames_since_keyframe = keyframe ? 0 : frames_since_keyframe + 1;
+	keyframe_requested = false;
+	return len;
+}
+}
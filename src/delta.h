@@ -0,0 +1,40 @@
+#ifndef IEC62056_MQTT_DELTA_H
+#define IEC62056_MQTT_DELTA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/* Compact binary encoding of slowly changing counters (such as energy registers) configured
+ * by DELTA_OBJECTS. Every frame holds all of the objects, in the configured order.
+ *
+ * Format: a type byte (0: keyframe, 1: delta frame) and a sequence number (varint), which
+ * increases by one with every frame, then for every object:
+ *   keyframe:    the number of decimals (byte) and the value as an integer in units of the
+ *                last decimal, e.g. 3 and 12345678 for "012345.678*kWh" (zig-zag varint)
+ *   delta frame: the change since the previous frame, in the same units (zig-zag varint)
+ * Varints are unsigned LEB128 (see capture.h), zig-zag maps 0, -1, 1, -2... to 0, 1, 2, 3...
+ *
+ * A receiver that sees a gap in the sequence numbers has to wait for the next keyframe,
+ * which can be requested by sending "resync" to the command topic. See tools/delta.py for
+ * a reference decoder. */
+namespace delta
+{
+using Values = std::map<std::string, std::string>;
+
+/* Number of configured objects */
+size_t count();
+char const *obis(size_t index);
+bool includes(std::string const &obis);
+
+/* Make the next frame a keyframe */
+void request_keyframe();
+/* Encode the values of a readout into a new frame and return its length, or 0 if there
+ * are no delta objects or some object doesn't have a valid value. The frame stays valid
+ * until the next call. */
+size_t encode(Values const &values);
+uint8_t const *frame();
+}
+
+#endif
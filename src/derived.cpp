@@ -0,0 +1,162 @@
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+#include "config.h"
+#include "derived.h"
+#include "fixed.h"
+
+namespace derived
+{
+enum class Op : uint8_t
+{
+	Sum,
+	Product,
+	Rate,
+};
+
+struct Definition
+{
+	char const *obis;
+	Op op;
+	char const *a, *b; /* b is nullptr for Rate */
+	uint8_t decimals;
+};
+
+#ifdef DERIVED_OBJECTS
+#define DERIVED_SUM(obis, a, b, decimals) {obis, Op::Sum, a, b, decimals},
+#define DERIVED_PRODUCT(obis, a, b, decimals) {obis, Op::Product, a, b, decimals},
+#define DERIVED_RATE(obis, a, decimals) {obis, Op::Rate, a, nullptr, decimals},
+static Definition const DEFINITIONS[] = {DERIVED_OBJECTS};
+#undef DERIVED_SUM
+#undef DERIVED_PRODUCT
+#undef DERIVED_RATE
+size_t const COUNT = sizeof(DEFINITIONS) / sizeof(DEFINITIONS[0]);
+#else
+static Definition const *const DEFINITIONS = nullptr;
+size_t const COUNT = 0;
+#endif
+
+size_t const MAX_RESULT_LENGTH = 24;
+
+struct State
+{
+	std::optional<Fixed> result;
+	char text[MAX_RESULT_LENGTH];
+
+	/* Rate only: the operand's value when it last changed, and when that happened */
+	std::optional<Fixed> last_value;
+	uint32_t last_change_ms;
+	bool seen_change;
+	/* Rate only: the last change of the operand, and how long it took */
+	Fixed last_step;
+	uint32_t last_interval_ms;
+};
+
+static State states[COUNT ? COUNT : 1];
+
+size_t count()
+{
+	return COUNT;
+}
+
+char const *obis(size_t index)
+{
+	return DEFINITIONS[index].obis;
+}
+
+char const *value(size_t index)
+{
+	return states[index].result ? states[index].text : nullptr;
+}
+
+/* Index of the derived object with this code listed before the given one, or COUNT */
+static size_t find(char const *obis, size_t before)
+{
+	for(size_t i = 0; i < before; ++i)
+	{
+		if(!strcmp(DEFINITIONS[i].obis, obis)) return i;
+	}
+	return COUNT;
+}
+
+void for_each_operand(void (*function)(char const *obis))
+{
+	for(size_t i = 0; i < COUNT; ++i)
+	{
+		if(find(DEFINITIONS[i].a, i) == COUNT) function(DEFINITIONS[i].a);
+		if(DEFINITIONS[i].b && find(DEFINITIONS[i].b, i) == COUNT) function(DEFINITIONS[i].b);
+	}
+}
+
+/* Operands are looked up among earlier derived objects first, then among the read values */
+static std::optional<Fixed> operand(char const *obis, size_t before, Values const &values)
+{
+	size_t index = find(obis, before);
+	if(index != COUNT) return states[index].result;
+
+	auto entry = values.find(obis);
+	if(entry == values.end()) return std::nullopt;
+
+	return parse_fixed(entry->second);
+}
+
+/* Average of the operand's change per hour between its last two changes. Until it changes
+ * twice, the time of the previous change is unknown and there is no result. While it doesn't
+ * change for longer than it took last time, the rate is at most one such change over the
+ * time since, so the result decays towards zero instead of sticking. */
+static std::optional<Fixed> rate(State &state, Fixed value, uint32_t now_ms)
+{
+	std::optional<Fixed> result = state.result; /* Keep the last result until the next change */
+
+	if(state.last_value && *state.last_value != value)
+	{
+		if(state.seen_change && now_ms != state.last_change_ms)
+			result = fixed_scale(value - *state.last_value, 60 * 60 * 1000, now_ms - state.last_change_ms);
+		state.seen_change = true;
+		state.last_step = value - *state.last_value;
+		state.last_interval_ms = now_ms - state.last_change_ms;
+	}
+	else if(result && now_ms - state.last_change_ms > state.last_interval_ms)
+	{
+		Fixed bound = fixed_scale(state.last_step, 60 * 60 * 1000, now_ms - state.last_change_ms);
+		if((bound < 0 ? -bound : bound) < (*result < 0 ? -*result : *result)) result = bound;
+	}
+
+	if(!state.last_value || *state.last_value != value)
+	{
+		state.last_value = value;
+		state.last_change_ms = now_ms;
+	}
+
+	return result;
+}
+
+void update(Values const &values, uint32_t now_ms)
+{
+	for(size_t i = 0; i < COUNT; ++i)
+	{
+		Definition const &def = DEFINITIONS[i];
+		State &state = states[i];
+
+		std::optional<Fixed> a = operand(def.a, i, values);
+		std::optional<Fixed> b = def.b ? operand(def.b, i, values) : std::nullopt;
+		if(!a || (def.b && !b)) continue; /* Keep the previous result */
+
+		switch(def.op)
+		{
+			case Op::Sum:
+				state.result = *a + *b;
+				break;
+			case Op::Product:
+				state.result = fixed_mul(*a, *b);
+				break;
+			case Op::Rate:
+				state.result = rate(state, *a, now_ms);
+				break;
+		}
+
+		if(state.result) format_fixed(state.text, sizeof(state.text), *state.result, def.decimals);
+	}
+}
+}
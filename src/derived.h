@@ -0,0 +1,28 @@
+#ifndef IEC62056_MQTT_DERIVED_H
+#define IEC62056_MQTT_DERIVED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/* Objects computed from the values of other objects after every successful readout,
+ * as configured by DERIVED_OBJECTS */
+namespace derived
+{
+using Values = std::map<std::string, std::string>;
+
+/* Number of configured derived objects */
+size_t count();
+char const *obis(size_t index);
+/* Returns nullptr if the object doesn't have a value (yet) */
+char const *value(size_t index);
+
+/* Calls the function for each object read from the meter that the derived objects are
+ * computed from, skipping the ones that are derived objects themselves */
+void for_each_operand(void (*function)(char const *obis));
+/* Recompute all derived objects from freshly read values */
+void update(Values const &values, uint32_t now_ms);
+}
+
+#endif
@@ -0,0 +1,260 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "dlms.h"
+
+namespace dlms
+{
+uint8_t const AARQ = 0x60;
+uint8_t const AARE = 0x61;
+uint8_t const AARE_RESULT = 0xa2;
+uint8_t const BER_INTEGER = 0x02;
+uint8_t const GET_REQUEST = 0xc0;
+uint8_t const GET_RESPONSE = 0xc4;
+uint8_t const NORMAL = 0x01;
+uint8_t const INVOKE_ID_AND_PRIORITY = 0xc1; /* Invoke id 1, confirmed, high priority */
+
+/* Logical name referencing without ciphering, lowest level security. The
+ * InitiateRequest proposes DLMS version 6, get as the only service and a maximum PDU size
+ * that fits into a single HDLC frame. */
+uint8_t const AARQ_TEMPLATE[] = {
+    AARQ, 0x1d,
+    0xa1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01, /* application-context-name */
+    0xbe, 0x10, 0x04, 0x0e,                                           /* user-information */
+    0x01, 0x00, 0x00, 0x00, 0x06,                                     /* InitiateRequest, version 6 */
+    0x5f, 0x1f, 0x04, 0x00, 0x00, 0x00, 0x10,                         /* conformance: get */
+    0x00, 0x7d};                                                      /* max receive PDU size */
+
+enum DataType : uint8_t
+{
+	STRUCTURE = 0x02,
+	DOUBLE_LONG = 0x05,
+	DOUBLE_LONG_UNSIGNED = 0x06,
+	OCTET_STRING = 0x09,
+	VISIBLE_STRING = 0x0a,
+	INTEGER = 0x0f,
+	LONG = 0x10,
+	UNSIGNED = 0x11,
+	LONG_UNSIGNED = 0x12,
+	LONG64 = 0x14,
+	LONG64_UNSIGNED = 0x15,
+	ENUM = 0x16,
+};
+
+bool parse_obis(std::string_view text, uint8_t out[6])
+{
+	unsigned groups[6];
+	size_t count = 0;
+	size_t pos = 0;
+	while(pos < text.size() && count < 6)
+	{
+		unsigned group = 0;
+		size_t start = pos;
+		for(; pos < text.size() && text[pos] >= '0' && text[pos] <= '9'; ++pos)
+		{
+			group = group * 10 + (text[pos] - '0');
+			if(group > 255) return false;
+		}
+		if(pos == start) return false; /* Not a digit, e.g. the letters of C.1.0 */
+		groups[count++] = group;
+
+		if(pos < text.size() && !strchr("-:.*&", text[pos])) return false;
+		++pos; /* Skip the separator */
+	}
+	if(pos < text.size()) return false;
+
+	uint8_t const DEFAULTS[6] = {1, 0, 0, 0, 0, 255};
+	size_t first = count == 3 ? 2 : 0; /* Short codes only have C.D.E */
+	if(count != 3 && count != 5 && count != 6) return false;
+
+	memcpy(out, DEFAULTS, 6);
+	for(size_t i = 0; i < count; ++i)
+	{
+		out[first + i] = groups[i];
+	}
+	return true;
+}
+
+size_t encode_aarq(uint8_t *out, size_t size)
+{
+	if(size < sizeof(AARQ_TEMPLATE)) return 0;
+
+	memcpy(out, AARQ_TEMPLATE, sizeof(AARQ_TEMPLATE));
+	return sizeof(AARQ_TEMPLATE);
+}
+
+bool aare_accepted(uint8_t const *apdu, size_t length)
+{
+	if(length < 2 || apdu[0] != AARE || apdu[1] >= 0x80 || apdu[1] > length - 2) return false;
+
+	/* Look for the result among the AARE's components */
+	size_t end = 2 + apdu[1];
+	for(size_t pos = 2; pos + 2 <= end; pos += 2 + apdu[pos + 1])
+	{
+		uint8_t tag = apdu[pos], len = apdu[pos + 1];
+		if(len >= 0x80 || pos + 2 + len > end) return false;
+		if(tag == AARE_RESULT) return len == 3 && apdu[pos + 2] == BER_INTEGER && apdu[pos + 4] == 0;
+	}
+	return false;
+}
+
+size_t encode_get_request(uint8_t *out, size_t size, uint16_t class_id, uint8_t const obis[6], uint8_t attribute)
+{
+	size_t const LENGTH = 13;
+	if(size < LENGTH) return 0;
+
+	out[0] = GET_REQUEST;
+	out[1] = NORMAL;
+	out[2] = INVOKE_ID_AND_PRIORITY;
+	out[3] = class_id >> 8;
+	out[4] = class_id & 0xff;
+	memcpy(&out[5], obis, 6);
+	out[11] = attribute;
+	out[12] = 0x00; /* No selective access */
+	return LENGTH;
+}
+
+/* Big endian integer of the given size, sign extended if it's signed */
+static int64_t get_integer(uint8_t const *data, size_t size, bool is_signed)
+{
+	uint64_t value = 0;
+	for(size_t i = 0; i < size; ++i)
+	{
+		value = value << 8 | data[i];
+	}
+	if(is_signed && size < 8 && data[0] & 0x80) value |= ~0ull << (size * 8);
+	return static_cast<int64_t>(value);
+}
+
+/* Size and signedness of integer types, 0 if it isn't one */
+static size_t integer_size(uint8_t type, bool &is_signed)
+{
+	is_signed = type == INTEGER || type == LONG || type == DOUBLE_LONG || type == LONG64;
+	switch(type)
+	{
+		case INTEGER:
+		case UNSIGNED:
+		case ENUM:
+			return 1;
+		case LONG:
+		case LONG_UNSIGNED:
+			return 2;
+		case DOUBLE_LONG:
+		case DOUBLE_LONG_UNSIGNED:
+			return 4;
+		case LONG64:
+		case LONG64_UNSIGNED:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+static bool parse_data(uint8_t const *data, size_t length, Data &out)
+{
+	if(!length) return false;
+
+	bool is_signed;
+	size_t size = integer_size(data[0], is_signed);
+	if(size)
+	{
+		if(length < 1 + size) return false;
+		out.type = Data::Type::Integer;
+		out.integer = get_integer(&data[1], size, is_signed);
+	}
+	else if(data[0] == OCTET_STRING || data[0] == VISIBLE_STRING)
+	{
+		if(length < 2 || data[1] >= 0x80 || length < 2u + data[1]) return false;
+		out.type = Data::Type::String;
+		out.string = std::string_view(reinterpret_cast<char const *>(&data[2]), data[1]);
+	}
+	else if(data[0] == STRUCTURE && length >= 6 && data[1] == 2 && data[2] == INTEGER && data[4] == ENUM)
+	{
+		out.type = Data::Type::ScalerUnit;
+		out.scaler = static_cast<int8_t>(data[3]);
+		out.unit = data[5];
+	}
+	else
+	{
+		out.type = Data::Type::Other;
+	}
+	return true;
+}
+
+GetResult parse_get_response(uint8_t const *apdu, size_t length, Data &out)
+{
+	if(length < 4 || apdu[0] != GET_RESPONSE || apdu[1] != NORMAL) return GetResult::Malformed;
+
+	if(apdu[3] != 0x00) return GetResult::AccessError; /* Not Data */
+
+	return parse_data(&apdu[4], length - 4, out) ? GetResult::Ok : GetResult::Malformed;
+}
+
+static char const *unit_symbol(uint8_t unit)
+{
+	switch(unit)
+	{
+		case 7:
+			return "s";
+		case 9:
+			return "\xc2\xb0" "C"; /* UTF-8 */
+		case 27:
+			return "W";
+		case 28:
+			return "VA";
+		case 29:
+			return "var";
+		case 30:
+			return "Wh";
+		case 31:
+			return "VAh";
+		case 32:
+			return "varh";
+		case 33:
+			return "A";
+		case 35:
+			return "V";
+		case 44:
+			return "Hz";
+		default:
+			return nullptr;
+	}
+}
+
+size_t format_value(char *out, size_t size, int64_t value, int8_t scaler, uint8_t unit)
+{
+	/* Avoid %lld, which isn't supported everywhere */
+	char digits[24];
+	uint64_t magnitude = value < 0 ? -static_cast<uint64_t>(value) : value;
+	size_t len = 0;
+	do
+	{
+		digits[len++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while(magnitude);
+
+	size_t decimals = scaler < 0 ? -scaler : 0;
+	while(len <= decimals && len < sizeof(digits))
+	{
+		digits[len++] = '0';
+	}
+
+	char text[48];
+	size_t pos = 0;
+	if(value < 0) text[pos++] = '-';
+	while(len)
+	{
+		text[pos++] = digits[--len];
+		if(len && len == decimals) text[pos++] = '.';
+	}
+	for(int8_t i = 0; i < scaler && pos < 40; ++i)
+	{
+		text[pos++] = '0';
+	}
+	text[pos] = 0;
+
+	char const *symbol = unit_symbol(unit);
+	return snprintf(out, size, symbol ? "%s*%s" : "%s", text, symbol);
+}
+}
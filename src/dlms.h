@@ -0,0 +1,64 @@
+#ifndef IEC62056_MQTT_DLMS_H
+#define IEC62056_MQTT_DLMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/* Just enough DLMS/COSEM (IEC 62056-5-3, -6-2) to read registers: an association without
+ * authentication or ciphering, using logical name referencing, and GET.request.normal */
+namespace dlms
+{
+/* Logical Link Control header in front of every APDU in HDLC information frames */
+uint8_t const LLC_REQUEST[] = {0xe6, 0xe6, 0x00};
+uint8_t const LLC_RESPONSE[] = {0xe6, 0xe7, 0x00};
+
+uint16_t const REGISTER_CLASS = 3;
+uint8_t const REGISTER_VALUE = 2;
+uint8_t const REGISTER_SCALER_UNIT = 3;
+
+uint8_t const NO_UNIT = 255;
+
+/* Parse an OBIS code into its 6 value groups. Accepts C.D.E (for electricity, A-B = 1-0
+ * and F = 255), A-B:C.D.E and A-B:C.D.E*F with any of the usual separators. */
+bool parse_obis(std::string_view text, uint8_t out[6]);
+
+/* Encode an AARQ. Return the length, or 0 if it doesn't fit. */
+size_t encode_aarq(uint8_t *out, size_t size);
+/* Whether an AARE accepts the association */
+bool aare_accepted(uint8_t const *apdu, size_t length);
+
+size_t encode_get_request(uint8_t *out, size_t size, uint16_t class_id, uint8_t const obis[6], uint8_t attribute);
+
+struct Data
+{
+	enum class Type : uint8_t
+	{
+		Integer,    /* Any of the integer types */
+		String,     /* Octet or visible string */
+		ScalerUnit, /* Structure of scaler (integer) and unit (enum) */
+		Other,
+	};
+
+	Type type;
+	int64_t integer;
+	std::string_view string; /* Points into the response */
+	int8_t scaler;
+	uint8_t unit;
+};
+
+enum class GetResult : uint8_t
+{
+	Ok,
+	AccessError, /* The meter answered with a data access result instead of data */
+	Malformed,
+};
+
+GetResult parse_get_response(uint8_t const *apdu, size_t length, Data &out);
+
+/* Format value * 10^scaler followed by "*" and the unit's symbol (if it has one), like
+ * snprintf */
+size_t format_value(char *out, size_t size, int64_t value, int8_t scaler, uint8_t unit);
+}
+
+#endif
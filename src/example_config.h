@@ -1,6 +1,7 @@
 #ifndef IEC62056_MQTT_CONFIG_H
 #define IEC62056_MQTT_CONFIG_H
 
+#include <cstddef>
 #include <cstdint>
 
 /* Optional: pin number of indicator LED. Comment out to disable it.
@@ -16,6 +17,28 @@ char const *const WIFI_PASS = "Your WiFi password here!";
 char const *const MQTT_SERVER_ADDRESS = "192.168.1.2";
 uint16_t const MQTT_SERVER_PORT = 1883;
 
+/* Connection attempts. WiFi connection attempts that take longer than WIFI_CONNECT_TIMEOUT
+ * are restarted, a single attempt to connect to the MQTT server blocks for up to
+ * MQTT_CONNECT_TIMEOUT. Failed attempts are retried after a random delay between half and
+ * all of the backoff, which doubles from RECONNECT_BACKOFF_MIN to RECONNECT_BACKOFF_MAX.
+ * Readouts continue while disconnected. */
+uint32_t const WIFI_CONNECT_TIMEOUT = 15000; /* ms */
+uint32_t const MQTT_CONNECT_TIMEOUT = 1000;  /* ms */
+uint32_t const RECONNECT_BACKOFF_MIN = 500;  /* ms */
+uint32_t const RECONNECT_BACKOFF_MAX = 60000; /* ms */
+
+/* Optional: remember the access point (BSSID and channel) and the IP configuration in RTC
+ * memory to skip the scan and DHCP when reconnecting after a reset. If connecting this way
+ * takes longer than FAST_BOOT_CONNECT_TIMEOUT, the cache is dropped and a normal connection
+ * attempt is made. Since the address isn't leased this way, the cache is also only used for
+ * FAST_BOOT_MAX_USES resets in a row, and for FAST_BOOT_LIFETIME at a time; keep the latter
+ * shorter than the DHCP server's lease time. RTC memory doesn't survive a power loss.
+ * Uncomment to enable it. */
+// #define FAST_BOOT
+uint32_t const FAST_BOOT_CONNECT_TIMEOUT = 3000;        /* ms */
+uint8_t const FAST_BOOT_MAX_USES = 10;
+uint32_t const FAST_BOOT_LIFETIME = 12 * 60 * 60 * 1000; /* ms */
+
 /* Used as a prefix for MQTT topics (by default) as well as the hostname */
 #define DEVICE_NAME "elec"
 
@@ -28,10 +51,62 @@ char const *const EXPORT_OBJECTS[] = {
     "31.7.0", "51.7.0", "71.7.0", // Current, each phase [A]
 };
 
+/* Optional: objects computed from the values of other objects after every successful
+ * readout and published like the ones read from the meter. Uncomment to enable it.
+ * Each entry is one of:
+ *   DERIVED_SUM(obis, a, b, decimals)      a + b
+ *   DERIVED_PRODUCT(obis, a, b, decimals)  a * b
+ *   DERIVED_RATE(obis, a, decimals)        average change of a per hour between its last
+ *                                          two changes, e.g. power [kW] from energy [kWh]
+ * Operands can be objects read from the meter (these are monitored, and therefore
+ * exported, automatically) or derived objects listed before. Results are computed
+ * exactly with 6 decimals and published with the given number of decimals, without
+ * a unit. Derived objects must not use codes the meter sends itself; tariff values
+ * (the last group) from 128 up are manufacturer-specific and meters rarely use them.
+ * The example computes the total energy [kWh] of both tariffs and the average power [kW]
+ * from it; DERIVED_PRODUCT("29.7.128", "32.7.0", "31.7.0", 1) would add the apparent
+ * power of phase 1 [VA]. */
+// #define DERIVED_OBJECTS DERIVED_SUM("15.8.128", "15.8.1", "15.8.2", 2) DERIVED_RATE("15.5.128", "15.8.128", 3)
+
+/* Optional: pin connected to a second phototransistor watching the meter's impulse LED.
+ * Between readouts, the power is estimated from the time between impulses and published
+ * to MQTT_PULSE_POWER_TOPIC in W. Uncomment to enable it. */
+// #define PULSE_PIN 5
+/* Edge of the pin signal at which an impulse starts: RISING or FALLING */
+#define PULSE_EDGE FALLING
+/* The meter constant (printed on the meter's front panel) */
+uint32_t const PULSE_IMP_PER_KWH = 1000;
+/* Impulses that come sooner than this after the previous one are ignored as noise */
+uint32_t const PULSE_DEBOUNCE = 20000; /* us */
+/* How often to publish the power estimate */
+uint32_t const PULSE_PUBLISH_INTERVAL = 1000; /* ms */
+/* Energy register [kWh] used to correct the meter constant after readouts. Must be
+ * exported or derived (15.8.128 with the example DERIVED_OBJECTS). */
+#define PULSE_CALIBRATION_OBJECT "15.8.1"
+
+/* Optional: slowly changing counters to publish to MQTT_DELTA_TOPIC as compact binary
+ * frames instead of as text. Every DELTA_KEYFRAME_INTERVAL-th frame holds the full values,
+ * the ones in between only the changes since the previous frame. Sending "resync" to the
+ * command topic makes the next frame a keyframe. See src/delta.h for the format and
+ * tools/delta.py for a decoder. Uncomment to enable it. */
+// #define DELTA_OBJECTS "15.8.1", "15.8.2"
+uint32_t const DELTA_KEYFRAME_INTERVAL = 60; /* frames */
+
+/* Optional: how often exported or derived objects need to be refreshed. Readouts are
+ * delayed (beyond READ_DELAY) until an object is due, and only the objects that are due
+ * are published. Objects that aren't listed are published after every readout.
+ * Intervals are in ms. */
+// #define REFRESH_INTERVALS REFRESH_INTERVAL("15.8.1", 900000) REFRESH_INTERVAL("15.8.2", 900000)
+
 /* Uncomment to strip the unit before publishing values. For example,
  * "230.5" instead of "230.5*V" */
 // #define STRIP_UNIT
 
+/* Uncomment to read meters that offer protocol mode E (HDLC and DLMS/COSEM) in that mode.
+ * Objects are read as registers (class 3) by their OBIS codes, which must be numeric.
+ * Values get the meter's units, which are usually W and Wh rather than kW and kWh. */
+// #define USE_MODE_E
+
 /* Uncomment to override automatic mode selection, for example to limit the baud
  * rate. Use if you have problems with your optical receiver. */
 // #define MODE_OVERRIDE '4'
@@ -41,11 +116,69 @@ char const *const EXPORT_OBJECTS[] = {
  * specified value. */
 uint32_t const READ_DELAY = 1000; /* ms */
 
+/* Optional: start readouts on wall-clock boundaries, every ALIGNED_READ_INTERVAL since
+ * midnight UTC (e.g. at :00, :10, :20 with 10 s), with the time from NTP_SERVER. Readouts
+ * start early by the time the meter takes to send its data block, which is the moment that
+ * is aligned, so samples from several meters line up. A readout that can't start within
+ * ALIGNED_READ_TOLERANCE of its time skips its slot. READ_DELAY and the backoff after
+ * errors still apply as the least time between readouts. Uncomment to enable it. */
+// #define ALIGNED_READ_INTERVAL 10000 /* ms, should divide a day */
+#define NTP_SERVER "pool.ntp.org"
+uint32_t const ALIGNED_READ_TOLERANCE = 50; /* ms */
+
 /* MQTT topics and topic prefixes */
 #define MQTT_TOPIC_PREFIX DEVICE_NAME "/"
 #define MQTT_LOG_PREFIX MQTT_TOPIC_PREFIX "log/"
 #define MQTT_COMMAND_TOPIC MQTT_TOPIC_PREFIX "cmd"
 #define MQTT_OBIS_PREFIX MQTT_TOPIC_PREFIX "obis/"
+#define MQTT_TRACE_TOPIC MQTT_TOPIC_PREFIX "trace"
+#define MQTT_PULSE_POWER_TOPIC MQTT_TOPIC_PREFIX "pulse/power"
+#define MQTT_CAPTURE_TOPIC MQTT_TOPIC_PREFIX "capture"
+#define MQTT_DELTA_TOPIC MQTT_TOPIC_PREFIX "delta"
+#define MQTT_PROFILE_TOPIC MQTT_TOPIC_PREFIX "profile"
+
+/* Optional: size of a ring buffer (a power of two) that the UART interrupt receives the
+ * meter's data into, instead of the serial driver's buffer. Bytes aren't lost while the main
+ * loop is busy, and parity/framing errors and overruns are counted per byte. Takes twice
+ * this much RAM (for the error flags). Uncomment to enable it. */
+// #define RX_RING_SIZE 1024
+
+/* Optional: size of a buffer recording the raw serial traffic of the last readout, with
+ * timing. After a failed readout, the buffer is kept until "capture" is sent to the
+ * command topic, which publishes it to MQTT_CAPTURE_TOPIC. See tools/replay.cpp for
+ * replaying captures on a PC. Uncomment to enable it. */
+// #define CAPTURE_BUFFER_SIZE 4096
+
+/* Uncomment to publish a (non-retained) latency trace of every successful readout
+ * to MQTT_TRACE_TOPIC. It contains a sequence number and the time from sending the
+ * request to the first data byte, checksum verification and publishing, in us.
+ * See tools/trace_stats.py for a tool that summarizes these. */
+// #define PUBLISH_TRACE
+
+/* Port of the HTTP endpoint serving metrics (readout counters, timings, heap, RSSI)
+ * in the Prometheus text format. Comment out to disable it. */
+#define METRICS_PORT 9100
+/* How long to wait for a scraper to send its request */
+uint32_t const METRICS_REQUEST_TIMEOUT = 100; /* ms */
+
+/* Optional: port of a TCP endpoint that streams readouts to local clients (such as a load
+ * controller) as soon as their checksum is verified, without going through the MQTT
+ * broker. See src/stream.h for the protocol. Every client has a send buffer of
+ * STREAM_CLIENT_BUFFER bytes, clients that fall further behind are disconnected.
+ * Uncomment to enable it. */
+// #define STREAM_PORT 9200
+size_t const STREAM_MAX_CLIENTS = 4;
+size_t const STREAM_MAX_OBJECTS = 16;  /* Per client */
+size_t const STREAM_CLIENT_BUFFER = 1024; /* bytes */
+
+/* Profile the main loop: CPU cycles spent in every scheduler task and in publishing and
+ * logging, summarized over windows of PROFILE_WINDOW. Iterations that take longer than
+ * PROFILE_BUDGET are counted, and the slowest one is kept with a breakdown of what ran.
+ * Sending "profile" to the command topic publishes a report of the last window to
+ * MQTT_PROFILE_TOPIC. Comment out to disable it. */
+#define PROFILE_LOOP
+uint32_t const PROFILE_WINDOW = 60000; /* ms */
+uint32_t const PROFILE_BUDGET = 20000; /* us */
 
 /* Default log level. Allowed values: None < Error < Warning < Info < Debug */
 #define DEFAULT_LOG_LEVEL Info
@@ -55,10 +188,16 @@ uint32_t const READ_DELAY = 1000; /* ms */
  * the newly-read value is discarded. This might not be needed if your optical reading
  * head is very well-protected from outside light, but since the checksum is only
  * 1 byte, it might be worth keeping. */
-char const *const OBJECT_VALUE_ALLOWED_CHARS = "0123456789.,:-";
+constexpr char const *OBJECT_VALUE_ALLOWED_CHARS = "0123456789.,:-";
 
-/* How long to wait for the meter to send responses to our requests. You shouldn't
- * need to change this. */
-uint32_t const SERIAL_TIMEOUT = 2000; /* ms */
+/* How long to wait for the meter to start sending responses to our requests. Once it
+ * has started, it's expected to send the rest without gaps (between bytes or lines) much
+ * longer than the ones seen during earlier successful readouts, and given up on after
+ * INTER_BYTE_TIMEOUT_MIN at the least. Most meters send without pauses, so a stalled
+ * readout ends 20 ms after its last byte. IEC 62056-21 allows up to 1500 ms between
+ * characters: if your meter pauses that long (e.g. between lines), set the minimum to
+ * 1500. */
+uint32_t const SERIAL_TIMEOUT = 2000;       /* ms */
+uint32_t const INTER_BYTE_TIMEOUT_MIN = 20; /* ms */
 
 #endif
@@ -0,0 +1,83 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include "fixed.h"
+
+#define UNIT_SEPARATOR '*'
+
+std::optional<Fixed> parse_fixed(std::string_view text)
+{
+	auto unit_sep_pos = text.find(UNIT_SEPARATOR);
+	if(unit_sep_pos != std::string_view::npos) text.remove_suffix(text.size() - unit_sep_pos);
+
+	bool negative = !text.empty() && text[0] == '-';
+	if(negative) text.remove_prefix(1);
+	if(text.empty()) return std::nullopt;
+
+	Fixed value = 0;
+	int8_t decimals = -1; /* Number of decimals read so far, -1 before the decimal point */
+	for(char c : text)
+	{
+		if((c == '.' || c == ',') && decimals < 0)
+		{
+			decimals = 0;
+		}
+		else if(c >= '0' && c <= '9')
+		{
+			if(decimals >= FIXED_DECIMALS) continue; /* Truncate */
+			if(value > (INT64_MAX - 9) / 10) return std::nullopt;
+
+			value = value * 10 + (c - '0');
+			if(decimals >= 0) ++decimals;
+		}
+		else
+		{
+			return std::nullopt;
+		}
+	}
+
+	for(int8_t i = decimals < 0 ? 0 : decimals; i < FIXED_DECIMALS; ++i)
+	{
+		if(value > INT64_MAX / 10) return std::nullopt;
+		value *= 10;
+	}
+
+	return negative ? -value : value;
+}
+
+size_t format_fixed(char *out, size_t size, Fixed value, uint8_t decimals)
+{
+	if(decimals > FIXED_DECIMALS) decimals = FIXED_DECIMALS;
+
+	char const *sign = value < 0 ? "-" : "";
+	uint64_t magnitude = value < 0 ? -static_cast<uint64_t>(value) : value;
+	uint64_t integer = magnitude / FIXED_ONE;
+	uint32_t fraction = magnitude % FIXED_ONE;
+	for(uint8_t i = decimals; i < FIXED_DECIMALS; ++i)
+	{
+		fraction /= 10;
+	}
+
+	/* Print the integer part in two halves, %llu isn't available everywhere */
+	char integer_text[24];
+	if(integer >= 1000000000)
+		snprintf(integer_text, sizeof(integer_text), "%" PRIu32 "%09" PRIu32,
+		         static_cast<uint32_t>(integer / 1000000000), static_cast<uint32_t>(integer % 1000000000));
+	else
+		snprintf(integer_text, sizeof(integer_text), "%" PRIu32, static_cast<uint32_t>(integer));
+
+	if(decimals == 0) return snprintf(out, size, "%s%s", sign, integer_text);
+	return snprintf(out, size, "%s%s.%0*" PRIu32, sign, integer_text, decimals, fraction);
+}
+
+Fixed fixed_mul(Fixed a, Fixed b)
+{
+	/* a * b / ONE, split so that the intermediate results stay small */
+	return (a / FIXED_ONE) * b + (a % FIXED_ONE) * b / FIXED_ONE;
+}
+
+Fixed fixed_scale(Fixed value, int64_t num, int64_t den)
+{
+	return value / den * num + value % den * num / den;
+}
@@ -0,0 +1,26 @@
+#ifndef IEC62056_MQTT_FIXED_H
+#define IEC62056_MQTT_FIXED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+/* Decimal fixed-point numbers, stored in millionths */
+using Fixed = int64_t;
+
+uint8_t const FIXED_DECIMALS = 6;
+Fixed const FIXED_ONE = 1000000;
+
+/* Parse an object value such as "-0012.345*kW". The unit (if any) is ignored.
+ * Digits beyond FIXED_DECIMALS are truncated. Returns nullopt if the value isn't
+ * a number or doesn't fit. */
+std::optional<Fixed> parse_fixed(std::string_view text);
+/* Format a value with the given number of decimals (truncating), like snprintf */
+size_t format_fixed(char *out, size_t size, Fixed value, uint8_t decimals);
+
+Fixed fixed_mul(Fixed a, Fixed b);
+/* Multiply by num/den without overflowing the intermediate result */
+Fixed fixed_scale(Fixed value, int64_t num, int64_t den);
+
+#endif
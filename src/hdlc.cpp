@@ -0,0 +1,102 @@
+#include <cstring>
+
+#include "hdlc.h"
+
+namespace hdlc
+{
+/* Frame format type 3, the segmentation bit and the top bits of the length */
+uint8_t const FORMAT_TYPE = 0xa0;
+uint8_t const FORMAT_MASK = 0xf0;
+uint8_t const SEGMENTED = 0x08;
+
+/* Format (2), addresses (2) and control, followed by the HCS (if there is information) and the FCS */
+size_t const HEADER_LENGTH = 5;
+size_t const CHECK_LENGTH = 2;
+
+uint16_t fcs16(uint8_t const *data, size_t length)
+{
+	uint16_t fcs = 0xffff;
+	for(size_t i = 0; i < length; ++i)
+	{
+		fcs ^= data[i];
+		for(unsigned bit = 0; bit < 8; ++bit)
+		{
+			fcs = fcs & 1 ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+		}
+	}
+	return ~fcs;
+}
+
+static void put_check(uint8_t *out, uint16_t fcs)
+{
+	out[0] = fcs & 0xff;
+	out[1] = fcs >> 8;
+}
+
+static bool check_matches(uint8_t const *data, size_t length)
+{
+	uint16_t fcs = fcs16(data, length);
+	return data[length] == (fcs & 0xff) && data[length + 1] == fcs >> 8;
+}
+
+size_t encode(uint8_t *out, size_t size, uint8_t control, uint8_t const *information, size_t length)
+{
+	size_t inner = HEADER_LENGTH + CHECK_LENGTH + (length ? CHECK_LENGTH + length : 0);
+	if(length > MAX_INFORMATION_LENGTH || inner + 2 > size) return 0;
+
+	out[0] = FLAG;
+	out[1] = FORMAT_TYPE | inner >> 8;
+	out[2] = inner & 0xff;
+	out[3] = SERVER_ADDRESS;
+	out[4] = CLIENT_ADDRESS;
+	out[5] = control;
+
+	size_t pos = 1 + HEADER_LENGTH;
+	if(length)
+	{
+		put_check(&out[pos], fcs16(&out[1], HEADER_LENGTH));
+		pos += CHECK_LENGTH;
+		memcpy(&out[pos], information, length);
+		pos += length;
+	}
+	put_check(&out[pos], fcs16(&out[1], pos - 1));
+	pos += CHECK_LENGTH;
+	out[pos++] = FLAG;
+
+	return pos;
+}
+
+size_t frame_length(uint8_t const *start)
+{
+	if(start[0] != FLAG || (start[1] & FORMAT_MASK) != FORMAT_TYPE || start[1] & SEGMENTED) return 0;
+
+	size_t inner = (start[1] & 0x07) << 8 | start[2];
+	return inner < HEADER_LENGTH + CHECK_LENGTH ? 0 : inner + 2;
+}
+
+Result decode(uint8_t const *frame, size_t length, Frame &out)
+{
+	if(length < 3 || frame_length(frame) != length || frame[length - 1] != FLAG) return Result::BadFormat;
+
+	size_t inner = length - 2;
+	if(!check_matches(&frame[1], inner - CHECK_LENGTH)) return Result::BadChecksum;
+
+	out.destination = frame[3];
+	out.source = frame[4];
+	out.control = frame[5];
+	out.information = nullptr;
+	out.length = 0;
+
+	size_t header = HEADER_LENGTH + CHECK_LENGTH; /* Up to the end of the HCS */
+	if(inner > HEADER_LENGTH + CHECK_LENGTH)
+	{
+		if(inner < header + CHECK_LENGTH + 1) return Result::BadFormat;
+		if(!check_matches(&frame[1], HEADER_LENGTH)) return Result::BadChecksum;
+
+		out.information = &frame[1 + header];
+		out.length = inner - header - CHECK_LENGTH;
+	}
+
+	return Result::Ok;
+}
+}
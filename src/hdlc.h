@@ -0,0 +1,71 @@
+#ifndef IEC62056_MQTT_HDLC_H
+#define IEC62056_MQTT_HDLC_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* HDLC frames as used by protocol mode E (IEC 62056-46): frame format type 3 with one byte
+ * addresses, no segmentation and no byte stuffing, since frames carry their length.
+ *
+ *   flag | format, length (2) | destination | source | control | [HCS (2) | information] | FCS (2) | flag
+ *
+ * The length covers everything between the flags. HCS and FCS are FCS-16 (as in
+ * RFC 1662), sent least significant byte first. */
+namespace hdlc
+{
+uint8_t const FLAG = 0x7e;
+
+/* Addresses as sent: shifted left with the end bit set */
+uint8_t const CLIENT_ADDRESS = 0x21; /* Public client (16) */
+uint8_t const SERVER_ADDRESS = 0x03; /* Management logical device (1) */
+
+/* Control field values, with the poll/final bit set */
+uint8_t const SNRM = 0x93;
+uint8_t const UA = 0x73;
+uint8_t const DISC = 0x53;
+uint8_t const DM = 0x1f;
+
+/* Also the default maximum information field length that both sides have to accept */
+size_t const MAX_INFORMATION_LENGTH = 128;
+size_t const MAX_FRAME_LENGTH = MAX_INFORMATION_LENGTH + 11;
+
+/* Control field of an information frame */
+inline uint8_t information_control(uint8_t send_sequence, uint8_t receive_sequence)
+{
+	return (receive_sequence & 0x07) << 5 | 0x10 | (send_sequence & 0x07) << 1;
+}
+
+inline bool is_information(uint8_t control)
+{
+	return !(control & 0x01);
+}
+
+uint16_t fcs16(uint8_t const *data, size_t length);
+
+/* Build a frame from the client to the server into out, flags included. Returns its
+ * length, or 0 if it doesn't fit. */
+size_t encode(uint8_t *out, size_t size, uint8_t control, uint8_t const *information, size_t length);
+
+struct Frame
+{
+	uint8_t destination, source, control;
+	uint8_t const *information; /* Points into the decoded frame */
+	size_t length;
+};
+
+enum class Result : uint8_t
+{
+	Ok,
+	BadFormat,
+	BadChecksum,
+};
+
+/* Decode a whole frame, flags included */
+Result decode(uint8_t const *frame, size_t length, Frame &out);
+
+/* Length of a frame from its first three bytes (flag and format), or 0 if they aren't
+ * the start of a supported frame */
+size_t frame_length(uint8_t const *start);
+}
+
+#endif
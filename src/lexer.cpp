@@ -0,0 +1,75 @@
+#include "lexer.h"
+
+namespace lexer
+{
+size_t const NONE = static_cast<size_t>(-1);
+
+/* The line is scanned in one pass, split into segments that are each handled by a tight
+ * loop: the OBIS code up to '(', the valid part of the value, and the rest of the line. */
+Line scan_line(std::string_view line)
+{
+	char const *data = line.data();
+	size_t const size = line.size();
+	uint8_t checksum = 0;
+	size_t i = 0;
+
+	size_t start = size && data[0] == STX ? 1 : 0;
+	if(start) checksum ^= STX;
+
+	/* OBIS code */
+	for(i = start; i < size && (CLASSES[data[i]] & OBIS); ++i)
+	{
+		checksum ^= data[i];
+	}
+	size_t lparen = i < size && data[i] == '(' ? i : NONE;
+
+	/* Value, as long as it's valid */
+	size_t first_invalid = NONE;
+	if(lparen != NONE)
+	{
+		checksum ^= '(';
+		for(i = lparen + 1; i < size && (CLASSES[data[i]] & VALUE); ++i)
+		{
+			checksum ^= data[i];
+		}
+		first_invalid = i;
+	}
+
+	/* The rest: the unit, the closing parenthesis and the terminator */
+	size_t rparen = NONE, unit_sep = NONE, end = NONE;
+	for(; i < size; ++i)
+	{
+		char c = data[i];
+		checksum ^= c;
+		if(!(CLASSES[c] & FRAMING) && c != UNIT_SEPARATOR) continue;
+
+		if(c == ')')
+			rparen = i;
+		else if(c == UNIT_SEPARATOR && end == NONE)
+			unit_sep = i;
+		else if((c == '\r' || c == '\n') && end == NONE)
+			end = i;
+	}
+
+	Line result = {Line::Kind::Invalid, checksum, line.substr(0, end), {}, {}, false};
+	if(!result.text.empty() && result.text.back() == '!')
+	{
+		result.kind = Line::Kind::End;
+	}
+	else if(lparen != NONE && rparen != NONE && rparen > lparen)
+	{
+		size_t value_end = rparen;
+#ifdef STRIP_UNIT
+		if(unit_sep != NONE && unit_sep < rparen) value_end = unit_sep;
+#else
+		(void)unit_sep;
+#endif
+		result.kind = Line::Kind::Data;
+		result.obis = line.substr(start, lparen - start);
+		result.value = line.substr(lparen + 1, value_end - (lparen + 1));
+		result.value_valid = first_invalid >= value_end;
+	}
+
+	return result;
+}
+}
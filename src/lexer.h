@@ -0,0 +1,76 @@
+#ifndef IEC62056_MQTT_LEXER_H
+#define IEC62056_MQTT_LEXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "config.h"
+
+namespace lexer
+{
+char const STX = '\x02';
+char const ETX = '\x03';
+char const UNIT_SEPARATOR = '*';
+
+/* Characters that may appear in an OBIS code besides digits and letters */
+constexpr char const *OBIS_SEPARATORS = "-:.*&";
+/* Characters with a special meaning in a data block */
+constexpr char const FRAMING_CHARS[] = {STX, ETX, '(', ')', '!', '/', '\r', '\n'};
+
+/* Character classes, combined as bit flags */
+uint8_t const VALUE = 1 << 0;   /* Allowed in object values (OBJECT_VALUE_ALLOWED_CHARS) */
+uint8_t const OBIS = 1 << 1;    /* Allowed in OBIS codes */
+uint8_t const FRAMING = 1 << 2; /* One of FRAMING_CHARS */
+
+struct ClassTable
+{
+	uint8_t classes[256];
+
+	constexpr uint8_t operator[](char c) const { return classes[static_cast<uint8_t>(c)]; }
+};
+
+constexpr ClassTable make_class_table(char const *value_chars)
+{
+	ClassTable table = {};
+	for(char const *c = value_chars; *c; ++c)
+		table.classes[static_cast<uint8_t>(*c)] |= VALUE;
+	for(char const *c = OBIS_SEPARATORS; *c; ++c)
+		table.classes[static_cast<uint8_t>(*c)] |= OBIS;
+	for(int c = 0; c < 256; ++c)
+	{
+		if((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+			table.classes[c] |= OBIS;
+	}
+	for(char c : FRAMING_CHARS)
+		table.classes[static_cast<uint8_t>(c)] |= FRAMING;
+	return table;
+}
+
+/* Built at compile time if OBJECT_VALUE_ALLOWED_CHARS is constexpr, as in example_config.h.
+ * Configurations that still declare it as char const *const get it built at startup. */
+inline ClassTable const CLASSES = make_class_table(OBJECT_VALUE_ALLOWED_CHARS);
+
+struct Line
+{
+	enum class Kind : uint8_t
+	{
+		Data,    /* obis(value) */
+		End,     /* ! - end of the data block */
+		Invalid, /* Anything else */
+	};
+
+	Kind kind;
+	uint8_t checksum;       /* XOR of all of the line's bytes */
+	std::string_view text;  /* Without the line terminator */
+	std::string_view obis;  /* Data only */
+	std::string_view value; /* Data only, without the unit if STRIP_UNIT is defined */
+	bool value_valid;       /* The value only contains OBJECT_VALUE_ALLOWED_CHARS */
+};
+
+/* Classify, split and validate a line of a data block (including its terminator) in
+ * a single pass. A leading STX is skipped. */
+Line scan_line(std::string_view line);
+}
+
+#endif
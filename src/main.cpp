@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <cinttypes>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <functional>
 #include <optional>
+#include <string_view>
 
 #include <Arduino.h>
 #include <ArduinoOTA.h>
@@ -11,160 +13,626 @@
 #include <HardwareSerial.h>
 #include <PubSubClient.h>
 
+#include "align.h"
+#include "capture.h"
 #include "config.h"
+#include "connection.h"
+#include "delta.h"
+#include "derived.h"
+#include "fixed.h"
 #include "logger.h"
 #include "meter.h"
+#include "metrics.h"
+#include "planner.h"
+#include "profiler.h"
+#include "pulse.h"
+#include "scheduler.h"
+#include "stream.h"
 
 static WiFiClient wifi_client;
 static PubSubClient mqtt(wifi_client);
+void on_wifi_connected();
+void on_connected();
+static ConnectionManager connection(mqtt, on_wifi_connected, on_connected);
 static MeterReader reader(Serial);
+#ifdef METRICS_PORT
+static WiFiServer metrics_server(METRICS_PORT);
+#endif
+
+#ifdef CAPTURE_BUFFER_SIZE
+static uint8_t capture_buffer[CAPTURE_BUFFER_SIZE];
+static Capture capture(capture_buffer, sizeof(capture_buffer));
+#endif
+
+#ifdef RX_RING_SIZE
+static_assert((RX_RING_SIZE & (RX_RING_SIZE - 1)) == 0, "RX_RING_SIZE must be a power of two");
+static uint8_t rx_ring_data[RX_RING_SIZE], rx_ring_flags[RX_RING_SIZE];
+static RxRing rx_ring(rx_ring_data, rx_ring_flags, RX_RING_SIZE);
+#endif
+
+#ifdef PULSE_PIN
+static PulseEstimator pulse_estimator(PULSE_IMP_PER_KWH, PULSE_DEBOUNCE);
+/* Impulse timestamps, filled by the ISR and drained by handle_pulses() */
+size_t const PULSE_QUEUE_SIZE = 32; /* Must be a power of 2 */
+static volatile uint32_t pulse_queue[PULSE_QUEUE_SIZE];
+static volatile uint32_t pulse_queue_head;
+static uint32_t pulse_queue_tail;
+#endif
+
+/* Scheduler tasks. The meter task advances the reader while a readout is in progress,
+ * the read timer starts readouts (and implements the backoff). */
+void run_meter();
+void start_readout();
+void run_connection();
+void run_ota();
+#ifdef LED_PIN
+void led_off();
+#endif
+
+static Task meter_task = {"meter", run_meter, 4, 0};
+static Task read_timer_task = {"read_timer", start_readout, 3, 0};
+static Task connection_task = {"connection", run_connection, 2, 10};
+static Task ota_task = {"ota", run_ota, 1, 20};
+#ifdef LED_PIN
+static Task led_task = {"led", led_off, 1, 0};
+#endif
+#ifdef METRICS_PORT
+void serve_metrics();
+static Task metrics_task = {"metrics", serve_metrics, 0, 50};
+#endif
+#ifdef STREAM_PORT
+static Task stream_task = {"stream", stream::poll, 2, 10};
+#endif
+#ifdef PULSE_PIN
+void handle_pulses();
+static Task pulse_task = {"pulse", handle_pulses, 2, 10};
+#endif
+
+/* Upper bound for sleeping between scheduler passes */
+uint32_t const MAX_SLEEP = 1000; /* ms */
+
+static uint32_t read_delay = READ_DELAY;
+/* How long the last successful readout took, used to start readouts early enough */
+static uint32_t readout_duration = 0; /* ms */
+/* When the last successful readout completed */
+static uint32_t readout_completed = 0;
+/* The values of the last readout haven't been published yet because the connection was down */
+static bool readout_pending = false;
+
+void publish_values();
+
+/* Called every time WiFi comes up */
+void on_wifi_connected()
+{
+	static bool started = false;
+	if(started) return;
+
+	/* Network services are started once the network is up for the first time, whether the
+	 * MQTT server can be reached or not */
+	ArduinoOTA.setHostname(DEVICE_NAME);
+	ArduinoOTA.begin();
+#ifdef METRICS_PORT
+	metrics_server.begin();
+#endif
+#ifdef STREAM_PORT
+	stream::begin();
+#endif
+	started = true;
+}
+
+/* Called every time the MQTT connection is (re)established */
+void on_connected()
+{
+	if(!metrics::get(metrics::Id::BootConnected)) metrics::set(metrics::Id::BootConnected, millis());
+
+	mqtt.subscribe(MQTT_COMMAND_TOPIC);
+	logger::info("connected after %" PRIu32 " ms", connection.reconnect_time());
+
+	if(readout_pending) publish_values();
+}
+
+#ifdef CAPTURE_BUFFER_SIZE
+/* Publish the capture, which holds the first failed readout since the last time it was
+ * published (or the last readout if none failed), and resume capturing */
+void publish_capture()
+{
+	mqtt.beginPublish(MQTT_CAPTURE_TOPIC, capture.size(), false);
+	mqtt.write(capture.data(), capture.size());
+	mqtt.endPublish();
+
+	capture.unfreeze();
+}
+#endif
+
+/* Publish the profiler's report of the last window */
+void publish_profile()
+{
+	static char report[1024];
+	size_t len = profiler::report(report, sizeof(report));
+	mqtt.beginPublish(MQTT_PROFILE_TOPIC, len, false);
+	mqtt.write(reinterpret_cast<uint8_t const *>(report), len);
+	mqtt.endPublish();
+}
+
+void mqtt_callback(char *topic, byte *payload_bytes, unsigned int length)
+{
+	std::string_view command(reinterpret_cast<char *>(payload_bytes), length);
+
+#ifdef CAPTURE_BUFFER_SIZE
+	if(command == "capture") return publish_capture();
+#endif
+	if(command == "resync") return delta::request_keyframe();
+	if(command == "profile") return publish_profile();
+
+	logger::warn("unknown command: %.*s", static_cast<int>(command.size()), command.data());
+}
+
+void mqtt_log(char const *level_name, char const *message)
+{
+	profiler::Section profile("logging");
+	char topic[sizeof(MQTT_LOG_PREFIX) + 10]; /* 10 characters should be enough for the level */
+	snprintf(topic, sizeof(topic), "%s%s", MQTT_LOG_PREFIX, level_name);
+	mqtt.publish(topic, message, true);
+}
+
+#ifdef PUBLISH_TRACE
+/* Publish the milestones of a readout. Times after the request are relative to it, in microseconds */
+void publish_trace(MeterReader::Trace const &trace, uint32_t publish_enqueued, uint32_t publish_written)
+{
+	char payload[128];
+	uint32_t start = trace.request_sent;
+	snprintf(payload, sizeof(payload),
+	         "{\"seq\":%" PRIu32 ",\"req\":%" PRIu32 ",\"first\":%" PRIu32 ",\"bcc\":%" PRIu32
+	         ",\"enq\":%" PRIu32 ",\"sent\":%" PRIu32 "}",
+	         trace.sequence, start, trace.first_byte - start, trace.checksum_verified - start,
+	         publish_enqueued - start, publish_written - start);
+	mqtt.publish(MQTT_TRACE_TOPIC, payload, false);
+}
+#endif
 
-void wifi_connect()
+/* Update the metrics that are only sampled when they are exported */
+void update_metric_snapshots()
 {
-	WiFi.mode(WIFI_STA);
-	WiFi.hostname(DEVICE_NAME);
-	WiFi.begin(WIFI_SSID, WIFI_PASS);
+	metrics::set(metrics::Id::ReadoutsOk, reader.successes());
+	metrics::set(metrics::Id::ReadoutsProtocolError, reader.errors());
+	metrics::set(metrics::Id::ReadoutsChecksumError, reader.checksum_errors());
+	metrics::set(metrics::Id::BytesReceived, reader.bytes_received());
+	metrics::set(metrics::Id::RxErrors, reader.rx_errors());
+	metrics::set(metrics::Id::RxOverruns, reader.rx_overruns());
+	metrics::set(metrics::Id::SerialTimeouts, reader.timeouts());
+	metrics::set(metrics::Id::SerialTimeoutTime, reader.timeout_time());
+	metrics::set(metrics::Id::InterByteTimeout, reader.inter_byte_timeout());
+	metrics::set(metrics::Id::SlotsSkipped, align::stats().slots_skipped);
+	metrics::set(metrics::Id::SlotPhaseError, align::stats().phase_error_us);
+	metrics::set(metrics::Id::SlotJitter, align::stats().jitter_us);
+	metrics::set(metrics::Id::SlotLead, align::stats().lead_us);
+	metrics::set(metrics::Id::LoopOverBudget, profiler::over_budget());
+#ifdef STREAM_PORT
+	metrics::set(metrics::Id::StreamClients, stream::stats().clients);
+	metrics::set(metrics::Id::StreamFrames, stream::stats().frames);
+	metrics::set(metrics::Id::StreamDropped, stream::stats().dropped);
+	metrics::set(metrics::Id::StreamRejected, stream::stats().rejected);
+#endif
+#ifdef RX_RING_SIZE
+	metrics::set(metrics::Id::RxRingOverruns, rx_ring.stats().overruns);
+	metrics::set(metrics::Id::RxFifoOverruns, rx_ring.stats().fifo_overruns);
+	metrics::set(metrics::Id::RxParityErrors, rx_ring.stats().parity_errors);
+	metrics::set(metrics::Id::RxFramingErrors, rx_ring.stats().framing_errors);
+	metrics::set(metrics::Id::RxRingHighWater, rx_ring.stats().high_water);
+#endif
+
+	uint32_t free_heap;
+	uint16_t max_block;
+	uint8_t heap_frag;
+	ESP.getHeapStats(&free_heap, &max_block, &heap_frag);
+	metrics::set(metrics::Id::HeapFree, free_heap);
+	metrics::set(metrics::Id::HeapFragmentation, heap_frag);
+	metrics::set(metrics::Id::HeapMaxBlock, max_block);
+	metrics::set(metrics::Id::Rssi, WiFi.RSSI());
+}
+
+#ifdef METRICS_PORT
+/* Metric families with a sample per task or per planned object, taken from one of its fields */
+struct TaskFamily
+{
+	char const *name, *help, *type;
+	uint32_t Task::*value;
+};
 
-	uint8_t timeout = 10;
-	while(timeout-- && !WiFi.isConnected())
+struct ObjectFamily
+{
+	char const *name, *help, *type;
+	uint32_t planner::Object::*value;
+};
+
+static TaskFamily const TASK_FAMILIES[] = {
+    {"iec62056_task_runs_total", "Scheduler task runs", "counter", &Task::runs},
+    {"iec62056_task_runtime_microseconds_total", "Time spent running scheduler tasks", "counter", &Task::total_us},
+    {"iec62056_task_max_runtime_microseconds", "Longest run of scheduler tasks", "gauge", &Task::max_us},
+};
+
+static ObjectFamily const OBJECT_FAMILIES[] = {
+    {"iec62056_object_refresh_target_milliseconds", "Target refresh interval (0: every readout)", "gauge",
+     &planner::Object::target_ms},
+    {"iec62056_object_refresh_interval_milliseconds", "Achieved refresh interval of objects", "gauge",
+     &planner::Object::interval_ms},
+    {"iec62056_object_refresh_interval_max_milliseconds", "Longest refresh interval of objects", "gauge",
+     &planner::Object::max_interval_ms},
+};
+
+static void write_metric_header(WiFiClient &client, char const *name, char const *help, char const *type)
+{
+	char buffer[192];
+	size_t len = snprintf(buffer, sizeof(buffer), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	client.write(reinterpret_cast<uint8_t const *>(buffer), std::min(len, sizeof(buffer) - 1));
+}
+
+/* Samples that don't fit the buffer (very long labels) are left out rather than cut off */
+static void write_metric_sample(WiFiClient &client, char const *name, char const *label, char const *label_value,
+                                uint32_t value)
+{
+	char buffer[192];
+	size_t len = snprintf(buffer, sizeof(buffer), "%s{%s=\"%s\"} %" PRIu32 "\n", name, label, label_value, value);
+	if(len >= sizeof(buffer)) return;
+	client.write(reinterpret_cast<uint8_t const *>(buffer), len);
+}
+
+/* Answer a pending scrape, if any. Whatever is requested, the metrics are returned. */
+void serve_metrics()
+{
+	WiFiClient client = metrics_server.available();
+	if(!client) return;
+
+	client.setTimeout(METRICS_REQUEST_TIMEOUT);
+	client.find("\r\n\r\n"); /* Skip the request headers */
+
+	update_metric_snapshots();
+	client.write("HTTP/1.0 200 OK\r\n"
+	             "Content-Type: text/plain; version=0.0.4\r\n"
+	             "Connection: close\r\n\r\n");
+
+	char buffer[256];
+	size_t position = 0, len;
+	while((len = metrics::render(buffer, sizeof(buffer), position)) > 0)
 	{
-		delay(1000);
+		client.write(reinterpret_cast<uint8_t const *>(buffer), len);
 	}
 
-	if(!WiFi.isConnected())
+	for(TaskFamily const &family : TASK_FAMILIES)
 	{
-		ESP.reset();
+		write_metric_header(client, family.name, family.help, family.type);
+		for(Task const *task = scheduler::tasks(); task; task = task->next_registered)
+			write_metric_sample(client, family.name, "task", task->name, task->*family.value);
 	}
-}
 
-void mqtt_connect()
-{
-	if(!WiFi.isConnected())
+	for(ObjectFamily const &family : OBJECT_FAMILIES)
 	{
-		wifi_connect();
+		write_metric_header(client, family.name, family.help, family.type);
+		for(size_t i = 0; i < planner::count(); ++i)
+		{
+			planner::Object const &object = planner::object(i);
+			write_metric_sample(client, family.name, "obis", object.obis, object.*family.value);
+		}
 	}
 
-	while(!mqtt.connected())
+	client.stop();
+	metrics::set(metrics::Id::LoopLatencyMax, 0); /* Start a new maximum for the next scrape */
+}
+#endif
+
+#ifdef PULSE_PIN
+IRAM_ATTR void on_pulse()
+{
+	uint32_t head = pulse_queue_head;
+	pulse_queue[head % PULSE_QUEUE_SIZE] = micros();
+	pulse_queue_head = head + 1;
+}
+
+/* Feed queued impulses to the estimator and publish the power estimate if it's time to */
+void handle_pulses()
+{
+	static uint32_t last_publish;
+
+	uint32_t head = pulse_queue_head;
+	if(head - pulse_queue_tail > PULSE_QUEUE_SIZE) /* The queue overflowed, skip the overwritten ones */
+		pulse_queue_tail = head - PULSE_QUEUE_SIZE;
+	while(pulse_queue_tail != head)
 	{
-		mqtt.connect("", MQTT_TOPIC_PREFIX "status/LWT", 1, true, "Offline");
+		pulse_estimator.pulse(pulse_queue[pulse_queue_tail++ % PULSE_QUEUE_SIZE]);
 	}
 
-	mqtt.publish(MQTT_TOPIC_PREFIX "status/LWT", "Online", true);
-	mqtt.subscribe(MQTT_COMMAND_TOPIC);
+	if(millis() - last_publish < PULSE_PUBLISH_INTERVAL) return;
+	last_publish = millis();
+
+	std::optional<Fixed> power = pulse_estimator.power(micros());
+	if(!power) return;
+
+	char payload[24];
+	format_fixed(payload, sizeof(payload), *power, 1);
+	mqtt.publish(MQTT_PULSE_POWER_TOPIC, payload, false);
 }
 
-void mqtt_callback(char *topic, byte *payload_bytes, unsigned int length)
+/* Correct the impulse constant using the energy register from the last readout */
+void calibrate_pulses()
 {
-	char *payload = reinterpret_cast<char *>(payload_bytes);
-	/* TODO */
+	char const *energy = nullptr;
+	auto entry = reader.values().find(PULSE_CALIBRATION_OBJECT);
+	if(entry != reader.values().end())
+		energy = entry->second.c_str();
+	for(size_t i = 0; !energy && i < derived::count(); ++i)
+	{
+		if(!strcmp(derived::obis(i), PULSE_CALIBRATION_OBJECT)) energy = derived::value(i);
+	}
+
+	std::optional<Fixed> value = energy ? parse_fixed(energy) : std::nullopt;
+	if(value) pulse_estimator.calibrate(*value);
 }
+#endif
 
-void mqtt_log(char const *level_name, char const *message)
+void record_loop_latency(uint32_t loop_start)
 {
-	char topic[sizeof(MQTT_LOG_PREFIX) + 10]; /* 10 characters should be enough for the level */
-	snprintf(topic, sizeof(topic), "%s%s", MQTT_LOG_PREFIX, level_name);
-	mqtt.publish(topic, message, true);
+	uint32_t latency = micros() - loop_start;
+	metrics::set(metrics::Id::LoopLatency, latency);
+	metrics::set_max(metrics::Id::LoopLatencyMax, latency);
 }
 
 void setup()
 {
 #ifdef LED_PIN
-	/* Set up the LED pin and blink it a few times to indicate startup */
+	/* Keep the LED on for a moment to indicate startup, without holding up the first readout */
 	pinMode(LED_PIN, OUTPUT);
-	digitalWrite(LED_PIN, LOW);
-	for(size_t i = 0; i < 4; ++i)
-	{
-		digitalWrite(LED_PIN, !digitalRead(LED_PIN));
-		delay(200);
-	}
+	digitalWrite(LED_PIN, HIGH);
 #endif
 
 	Serial.setTimeout(SERIAL_TIMEOUT);
 
-	wifi_connect();
-
-	ArduinoOTA.setHostname(DEVICE_NAME);
-	ArduinoOTA.begin();
-
+	wifi_client.setTimeout(MQTT_CONNECT_TIMEOUT);
 	mqtt.setServer(MQTT_SERVER_ADDRESS, MQTT_SERVER_PORT);
 	mqtt.setCallback(mqtt_callback);
-	mqtt_connect();
+	connection.begin();
+	align::begin();
 
 	logger::set_message_sink(mqtt_log);
 	logger::set_timestamp_source(millis);
 	logger::set_level(logger::Level::DEFAULT_LOG_LEVEL);
 
+#ifdef PULSE_PIN
+	pinMode(PULSE_PIN, INPUT);
+	attachInterrupt(digitalPinToInterrupt(PULSE_PIN), on_pulse, PULSE_EDGE);
+#endif
+
+#ifdef CAPTURE_BUFFER_SIZE
+	reader.set_capture(&capture);
+#endif
+#ifdef RX_RING_SIZE
+	reader.set_rx_ring(&rx_ring, UART0);
+#endif
+
 	/* Monitor all of the objects that we want to export over MQTT */
 	for(char const *obis : EXPORT_OBJECTS)
 	{
 		reader.start_monitoring(obis);
 	}
+	/* As well as the ones needed to compute derived objects */
+	derived::for_each_operand([](char const *obis) { reader.start_monitoring(obis); });
+	/* Plan the refreshes of everything that is published as text */
+	for(char const *obis : EXPORT_OBJECTS)
+	{
+		planner::add(obis);
+	}
+	for(size_t i = 0; i < derived::count(); ++i)
+	{
+		planner::add(derived::obis(i));
+	}
+	/* And the ones encoded as deltas */
+	for(size_t i = 0; i < delta::count(); ++i)
+	{
+		reader.start_monitoring(delta::obis(i));
+	}
+	/* Both would be published to the same topic */
+	for(size_t i = 0; i < derived::count(); ++i)
+	{
+		if(reader.values().count(derived::obis(i)))
+			logger::err("derived object %s is also read from the meter, give it a code of its own", derived::obis(i));
+	}
+
+#ifdef PROFILE_LOOP
+	scheduler::on_task_run(profiler::task_ran);
+#endif
+	scheduler::add(meter_task);
+	scheduler::add(read_timer_task);
+	scheduler::add(connection_task);
+	scheduler::add(ota_task);
+#ifdef LED_PIN
+	scheduler::add(led_task);
+	scheduler::schedule_in(led_task, 800);
+#endif
+#ifdef METRICS_PORT
+	scheduler::add(metrics_task);
+#endif
+#ifdef PULSE_PIN
+	scheduler::add(pulse_task);
+#endif
+#ifdef STREAM_PORT
+	scheduler::add(stream_task);
+#endif
+	/* Wake up as soon as the meter sends something during a readout */
+	scheduler::wake_on([]() { return reader.status() == MeterReader::Status::Busy && reader.available() > 0; },
+	                   meter_task);
+	scheduler::schedule_in(read_timer_task, 0);
 }
 
-void do_background_tasks()
+void run_ota()
 {
 	ArduinoOTA.handle();
+}
+
+void run_connection()
+{
+	connection.loop();
+
+	metrics::set(metrics::Id::ConnectionState, static_cast<uint32_t>(connection.state()));
+	metrics::set(metrics::Id::ConnectionTransitions, connection.transitions());
+	metrics::set(metrics::Id::ReconnectTime, connection.reconnect_time());
+}
+
+#ifdef LED_PIN
+void led_off()
+{
+	digitalWrite(LED_PIN, LOW);
+}
+#endif
+
+void start_readout()
+{
+	if(!align::start()) return scheduler::schedule_in(read_timer_task, align::delay_until_slot(0));
+
+	reader.start_reading();
+	scheduler::schedule_in(meter_task, 0);
+}
+
+/* Publish the values of the last readout that are due, derived objects included */
+void publish_values()
+{
+	profiler::Section profile("publish");
+	char topic[sizeof(MQTT_OBIS_PREFIX) + MAX_OBIS_CODE_LENGTH];
+	strcpy(topic, MQTT_OBIS_PREFIX);
+
+	size_t failed = 0;
+	char *obis_start = &topic[sizeof(MQTT_OBIS_PREFIX) - 1];
+	for(auto const &entry : reader.values())
+	{
+		/* Delta encoded objects are published below */
+		if(!delta::includes(entry.first) && planner::due(entry.first.c_str(), readout_completed))
+		{
+			strlcpy(obis_start, entry.first.c_str(), MAX_OBIS_CODE_LENGTH + 1);
+			if(mqtt.publish(topic, entry.second.c_str(), true))
+				planner::published(entry.first.c_str(), readout_completed);
+			else
+				++failed;
+		}
+	}
+	for(size_t i = 0; i < derived::count(); ++i)
+	{
+		char const *value = derived::value(i);
+		if(value && planner::due(derived::obis(i), readout_completed))
+		{
+			strlcpy(obis_start, derived::obis(i), MAX_OBIS_CODE_LENGTH + 1);
+			if(mqtt.publish(topic, value, true))
+				planner::published(derived::obis(i), readout_completed);
+			else
+				++failed;
+		}
+	}
+
+	size_t frame_length = delta::encode(reader.values());
+	if(frame_length) mqtt.publish(MQTT_DELTA_TOPIC, delta::frame(), frame_length, false);
 
-	if(!mqtt.loop()) /* PubSubClient::loop() returns false if not connected */
+	readout_pending = false;
+	/* The ones that failed are retried with the next readout */
+	metrics::set(metrics::Id::PublishQueueDepth, failed);
+	if(!metrics::get(metrics::Id::BootFirstPublish))
 	{
-		mqtt_connect();
+		metrics::set(metrics::Id::BootFirstPublish, millis());
+		logger::info("first values published %" PRIu32 " ms after boot", millis());
 	}
 }
 
-void delay_handle_background(long time)
+#ifdef STREAM_PORT
+/* Value of an object from the last readout, derived objects included */
+char const *find_value(char const *obis)
 {
-	long const increment = 5;
-	while((time -= increment) > 0)
+	auto entry = reader.values().find(obis);
+	if(entry != reader.values().end()) return entry->second.c_str();
+	for(size_t i = 0; i < derived::count(); ++i)
 	{
-		do_background_tasks();
-		delay(increment);
+		if(!strcmp(derived::obis(i), obis)) return derived::value(i);
 	}
+	return nullptr;
 }
+#endif
 
-void loop()
+/* Process the values of a successful readout and publish them, or keep them until the
+ * connection is back up */
+void handle_readout()
 {
-	static uint32_t next_delay = READ_DELAY;
-	bool read_just_completed = false;
-	do_background_tasks();
+	uint32_t publish_enqueued = micros();
+	MeterReader::Trace const &trace = reader.trace();
+	readout_completed = millis();
+	readout_duration = (trace.checksum_verified - trace.request_sent) / 1000;
+	align::completed(trace.first_byte);
+	derived::update(reader.values(), readout_completed);
+#ifdef STREAM_PORT
+	stream::send(trace.sequence, find_value); /* Local clients don't wait for the broker */
+#endif
+#ifdef PULSE_PIN
+	calibrate_pulses();
+#endif
 
+	readout_pending = true;
+	if(!metrics::get(metrics::Id::BootFirstReadout)) metrics::set(metrics::Id::BootFirstReadout, millis());
+	/* Stays up while the connection is down */
+	metrics::set(metrics::Id::PublishQueueDepth, reader.values().size() + derived::count());
+	if(!connection.connected()) return; /* The latest values are published after reconnecting */
+
+	publish_values();
+
+	metrics::set(metrics::Id::PhaseFirstByte, trace.first_byte - trace.request_sent);
+	metrics::set(metrics::Id::PhaseDataBlock, trace.checksum_verified - trace.first_byte);
+	metrics::set(metrics::Id::PhasePublish, micros() - publish_enqueued);
+
+#ifdef PUBLISH_TRACE
+	publish_trace(reader.trace(), publish_enqueued, micros());
+#endif
+}
+
+void run_meter()
+{
 	reader.loop();
 	MeterReader::Status status = reader.status();
 
-	if(status == MeterReader::Status::Ready)
+	if(status == MeterReader::Status::Ready) return; /* Woken up between readouts */
+	/* While the reader waits for the meter, sleep until data arrives (see wake_on()) or the
+	 * wait times out */
+	if(status == MeterReader::Status::Busy) return scheduler::schedule_in(meter_task, reader.wait_ms());
+
+	static bool retried = false;
+	uint32_t next_readout;
+	if(status == MeterReader::Status::Ok)
 	{
-		reader.start_reading();
+		read_delay = READ_DELAY; /* Reset delay to default */
+		retried = false;
+		handle_readout();
+		uint32_t earliest = std::max(read_delay, planner::time_until_due(millis(), readout_duration));
+		next_readout = align::delay_until_slot(earliest);
 	}
-	else if(status == MeterReader::Status::Ok)
+	else /* Not Ready, Ok or Busy => error */
 	{
-		read_just_completed = true; /* Read completed successfully */
-		next_delay = READ_DELAY;    /* Reset delay to default */
-		char topic[sizeof(MQTT_OBIS_PREFIX) + MAX_OBIS_CODE_LENGTH];
-		strcpy(topic, MQTT_OBIS_PREFIX);
-
-		char *obis_start = &topic[sizeof(MQTT_OBIS_PREFIX) - 1];
-		for(auto const &entry : reader.values())
+#ifdef CAPTURE_BUFFER_SIZE
+		capture.freeze(); /* Keep the failed readout until it's requested */
+#endif
+		if(reader.timed_out() && !retried)
 		{
-			strlcpy(obis_start, entry.first.c_str(), MAX_OBIS_CODE_LENGTH + 1);
-			mqtt.publish(topic, entry.second.c_str(), true);
+			/* The meter stopped sending, which is detected quickly. That's often a one-off
+			 * glitch, so try again right away once before backing off. */
+			retried = true;
+			next_readout = 0;
+			logger::warn("retrying (status=%u)", status);
 		}
-
-		reader.acknowledge();
-	}
-	else if(status != MeterReader::Status::Busy) /* Not Ready, Ok or Busy => error */
-	{
-		read_just_completed = true; /* Read completed with error */
-		next_delay *= 2;
-		if(next_delay > 60 * 1000)
+		else
 		{
-			next_delay = 60 * 1000;
+			read_delay *= 2;
+			if(read_delay > 60 * 1000)
+			{
+				read_delay = 60 * 1000;
+			}
+			next_readout = align::delay_until_slot(read_delay);
+			logger::warn("backoff (status=%u): %" PRIu32, status, read_delay);
 		}
-		logger::warn("backoff (status=%u): %" PRIu32, status, next_delay);
-
-		reader.acknowledge();
 	}
 
-	/* If we didn't just complete a read, skip logging and LED blinking */
-	if(!read_just_completed) return;
+	reader.acknowledge();
+	scheduler::schedule_in(read_timer_task, next_readout);
 
 	size_t successes = reader.successes();
 	size_t errors = reader.errors();
@@ -180,16 +648,19 @@ void loop()
 	              free_heap, heap_frag, max_block);
 
 #ifdef LED_PIN
+	/* Flash the LED after a successful read, keep it on until the next one after an error */
 	digitalWrite(LED_PIN, HIGH);
+	scheduler::schedule_in(led_task, status == MeterReader::Status::Ok ? 25 : read_delay);
+#endif
+}
 
-	delay_handle_background(25);
-	if(status == MeterReader::Status::Ok)
-		digitalWrite(LED_PIN, LOW);
+void loop()
+{
+	uint32_t loop_start = micros();
+	profiler::iteration_started();
+	scheduler::run_due();
+	profiler::iteration_finished();
+	record_loop_latency(loop_start);
 
-	if(next_delay >= 25)
-		delay_handle_background(next_delay - 25);
-	digitalWrite(LED_PIN, LOW);
-#else
-	delay_handle_background(next_delay);
-#endif
+	scheduler::sleep(MAX_SLEEP);
 }
@@ -1,18 +1,25 @@
 #include <cinttypes>
 #include <cstdint>
+#include <cstdio>
 #include <optional>
 #include <string_view>
 
+#include <Arduino.h>
+
 #include "config.h"
+#include "dlms.h"
+#include "lexer.h"
 #include "logger.h"
 #include "meter.h"
 
-#define STX '\x02'
-#define ETX '\x03'
+using lexer::ETX;
+using lexer::STX;
 
 #define ACK "\x06"
 
-#define UNIT_SEPARATOR '*'
+/* The inter-byte timeout is at least this many bit times (4 characters), or twice the
+ * longest gap seen during successful readouts if that is longer */
+uint32_t const MIN_INTER_BYTE_GAP = 40; /* bits */
 
 uint16_t const BAUD_RATES[] = {
     /* 0 */ 300,
@@ -39,17 +46,6 @@ static BaudSwitchParameters baud_char_to_params(char identification)
 		return {false, std::nullopt};                         /* no acknowledgement, don't switch baud */
 }
 
-static bool is_valid_object_value(std::string_view value)
-{
-	for(size_t i = 0; i < value.size(); ++i)
-	{
-		if(!strchr(OBJECT_VALUE_ALLOWED_CHARS, value[i]))
-			return false;
-	}
-
-	return true;
-}
-
 enum class MeterReader::Step : uint8_t
 {
 	Ready,
@@ -58,6 +54,11 @@ enum class MeterReader::Step : uint8_t
 	IdentificationRead,
 	InData,
 	AfterData,
+	/* Protocol mode E */
+	HdlcConnect,
+	Associate,
+	ReadRegister,
+	Disconnect,
 };
 
 /* status != Busy => status = Busy => continued on next line
@@ -65,24 +66,29 @@ enum class MeterReader::Step : uint8_t
  *                                    ... => status = ProtocolError                     => status = Ready
  *                                                            => status = ChecksumError => status = Ready
  *                                                            => status = ProtocolError => status = Ready
+ * Mode E:                 ... => step = IdentificationRead => step = HdlcConnect => step = Associate
+ *                             => step = ReadRegister (once per attribute) => step = Disconnect => status = Ok
  */
 
 void MeterReader::send_request()
 {
-	serial_.begin(INITIAL_BAUD_RATE, SERIAL_7E1); /* TX_ONLY here breaks for some reason */
+	if(capture_) capture_->clear(micros());
+	serial_begin(INITIAL_BAUD_RATE, SERIAL_7E1); /* TX_ONLY here breaks for some reason */
 
 	logger::debug("sending request");
-	serial_.write("/?!\r\n");
+	serial_write("/?!\r\n", 5);
 	serial_.flush();
+	trace_.request_sent = micros();
+	serial_begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_RX_ONLY); /* Before the response arrives */
 
 	step_ = Step::RequestSent;
 }
 
 void MeterReader::read_identification()
 {
-	serial_.begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_RX_ONLY);
-	char identification[MAX_IDENTIFICATION_LENGTH];
-	size_t len = serial_.readBytesUntil('\n', identification, MAX_IDENTIFICATION_LENGTH);
+	char identification[MAX_IDENTIFICATION_LENGTH + 1];
+	size_t len = serial_read_until('\n', identification, sizeof(identification), SERIAL_TIMEOUT * 1000);
+	if(len && identification[len - 1] == '\n') --len;
 
 	if(len < 6)
 	{
@@ -97,6 +103,11 @@ void MeterReader::read_identification()
 	baud_char_ = identification[4];
 #else
 	baud_char_ = MODE_OVERRIDE;
+#endif
+#ifdef USE_MODE_E
+	/* The escape sequence "\2" after the baud rate character announces protocol mode E */
+	mode_e_ = len >= 7 && identification[5] == '\\' && identification[6] == '2' && baud_char_ >= '0' &&
+	          baud_char_ <= '6';
 #endif
 	step_ = Step::IdentificationRead;
 }
@@ -105,116 +116,521 @@ void MeterReader::switch_baud()
 {
 	BaudSwitchParameters params = baud_char_to_params(baud_char_);
 
+	if(mode_e_)
+	{
+		/* Acknowledge with the HDLC protocol procedure (V=2) in binary mode (Y=2) */
+		char ack[7];
+		snprintf(ack, sizeof(ack), ACK "2%c2\r\n", baud_char_);
+		serial_begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_TX_ONLY);
+		serial_write(ack, 6);
+		serial_.flush();
+
+		logger::debug("mode E, switching to %" PRIu32 "bps", *params.new_baud);
+		serial_begin(*params.new_baud, SERIAL_8N1);
+		send_sequence_ = receive_sequence_ = 0;
+		trace_.first_byte = 0;
+		step_ = Step::HdlcConnect;
+		return;
+	}
+
 	if(params.send_acknowledgement)
 	{
-		serial_.begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_TX_ONLY);
-		serial_.printf(ACK "0%c0\r\n", baud_char_);
+		char ack[7];
+		snprintf(ack, sizeof(ack), ACK "0%c0\r\n", baud_char_);
+		serial_begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_TX_ONLY);
+		serial_write(ack, 6);
 		serial_.flush();
 	}
 
 	if(params.new_baud)
 	{
 		logger::debug("switching to %" PRIu32 "bps", *params.new_baud);
-		serial_.begin(*params.new_baud, SERIAL_7E1, SERIAL_RX_ONLY);
+		serial_begin(*params.new_baud, SERIAL_7E1, SERIAL_RX_ONLY);
 	}
 	else
 	{
-		serial_.begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_RX_ONLY);
+		serial_begin(INITIAL_BAUD_RATE, SERIAL_7E1, SERIAL_RX_ONLY);
 	}
 
 	step_ = Step::InData;
 	checksum_ = STX; /* Start with checksum=STX to avoid having to avoid xoring it */
+	trace_.first_byte = 0;
+}
+
+/* Wait until at least one byte can be read or the timeout expires */
+bool MeterReader::wait_available(uint32_t timeout_us)
+{
+	uint32_t start = wait_start();
+	while(!available())
+	{
+		if(micros() - start >= timeout_us)
+		{
+			account_timeout(micros() - start);
+			return false;
+		}
+		yield();
+	}
+
+	return true;
+}
+
+bool MeterReader::waiting_for_data() const
+{
+	return status_ == Status::Busy &&
+	       (step_ == Step::RequestSent || step_ == Step::InData || step_ == Step::AfterData || awaiting_reply_) &&
+	       !available();
+}
+
+/* How long the current step waits for its first byte */
+uint32_t MeterReader::step_timeout_us() const
+{
+	if(step_ == Step::RequestSent || (step_ == Step::InData && !trace_.first_byte) || awaiting_reply_)
+		return SERIAL_TIMEOUT * 1000;
+	return inter_byte_timeout();
+}
+
+uint32_t MeterReader::wait_start()
+{
+	uint32_t start = waiting_ ? waiting_since_ : micros();
+	waiting_ = false;
+	return start;
+}
+
+uint32_t MeterReader::wait_ms() const
+{
+	if(!waiting_ || !waiting_for_data()) return 0;
+
+	uint32_t waited_us = micros() - waiting_since_;
+	uint32_t timeout_us = step_timeout_us();
+	return waited_us < timeout_us ? (timeout_us - waited_us + 999) / 1000 : 0;
+}
+
+void MeterReader::account_timeout(uint32_t waited_us)
+{
+	++timeouts_;
+	timeout_ms_ += waited_us / 1000;
+	timed_out_ = true;
+}
+
+uint32_t MeterReader::inter_byte_timeout() const
+{
+	/* Before the first successful readout, learned_gap_bits_ is 0 and only the baud rate
+	 * and the floor count */
+	uint32_t bits = learned_gap_bits_ * 2 > MIN_INTER_BYTE_GAP ? learned_gap_bits_ * 2 : MIN_INTER_BYTE_GAP;
+	uint32_t timeout_us = static_cast<uint64_t>(bits) * 1000000 / baud_;
+	return timeout_us > INTER_BYTE_TIMEOUT_MIN * 1000 ? timeout_us : INTER_BYTE_TIMEOUT_MIN * 1000;
 }
 
 void MeterReader::read_line()
 {
-	static char line[MAX_LINE_LENGTH];
+	static char line[MAX_LINE_LENGTH + 1];
+
+	if(!trace_.first_byte)
+	{
+		/* Timestamp the start of the data block before blocking on the whole line. The meter
+		 * may take a while to start sending after switching the baud rate, but once it has,
+		 * the lines should follow each other closely. */
+		if(!wait_available(SERIAL_TIMEOUT * 1000))
+		{
+			logger::err("no data block");
+			return change_status(Status::ProtocolError);
+		}
+		trace_.first_byte = block_last_byte_ = micros();
+		if(rx_ring_) rx_ring_->take_max_gap_us(); /* Forget the pause before the data block */
+	}
 
-	size_t len = serial_.readBytesUntil('\n', line, MAX_LINE_LENGTH);
-	if(len == MAX_LINE_LENGTH)
+	std::string_view received;
+	if(rx_ring_)
+		received = receive_line(line, sizeof(line), inter_byte_timeout()); /* Only copied if it wraps around */
+	else
+		received = std::string_view(line, serial_read_until('\n', line, sizeof(line), inter_byte_timeout()));
+	size_t len = received.size();
+	if(len == sizeof(line) && received[len - 1] != '\n')
 	{
 		logger::warn("probably truncated a line, expect a checksum error");
 	}
-	else if(len < 2) /* A valid line will never be shorter than this */
+	else if(len < 3) /* A valid line will never be shorter than this */
 	{
+		if(rx_ring_) rx_ring_->consume(len);
 		logger::err("read short line or timed out");
 		return change_status(Status::ProtocolError);
 	}
 
-	for(size_t i = 0; i < len; ++i)
+	lexer::Line scanned = lexer::scan_line(received);
+	checksum_ ^= scanned.checksum;
+	logger::debug("line: %.*s", static_cast<int>(scanned.text.size()), scanned.text.data());
+
+	switch(scanned.kind)
+	{
+		case lexer::Line::Kind::End: /* End of data, ETX and checksum will follow */
+			step_ = Step::AfterData;
+			break;
+		case lexer::Line::Kind::Data:
+			if(scanned.value_valid) handle_object(scanned.obis, scanned.value);
+			break;
+		case lexer::Line::Kind::Invalid:
+			logger::warn("improper data line format");
+			break;
+	}
+	if(rx_ring_) rx_ring_->consume(len); /* The values have been copied by now */
+}
+
+void MeterReader::handle_object(std::string_view obis, std::string_view value)
+{
+	auto entry = values_.find(std::string(obis)); /* TODO avoid copy? */
+	if(entry != values_.end())
+		entry->second = value;
+}
+
+void MeterReader::verify_checksum()
+{
+	/* Expecting ETX and then the checksum */
+	uint8_t etx_bcc[2];
+	size_t len = serial_read(etx_bcc, 2, inter_byte_timeout());
+	if(len != 2 || etx_bcc[0] != ETX)
+	{
+		logger::err("failed to read checksum");
+		return change_status(Status::ProtocolError);
+	}
+
+	checksum_ ^= ETX;
+	if(checksum_ != etx_bcc[1])
+	{
+		logger::err("checksum mismatch: %02" PRIx8 " != %02" PRIx8, checksum_, etx_bcc[1]);
+		return change_status(Status::ChecksumError);
+	}
+
+	trace_.checksum_verified = micros();
+	return change_status(Status::Ok); /* Data readout successful */
+}
+
+/* Send a frame. Its response is received by the same step when it runs again, which it
+ * does once data has arrived (see waiting_for_data()). */
+void MeterReader::hdlc_send(uint8_t control, uint8_t const *information, size_t length)
+{
+	static uint8_t frame[hdlc::MAX_FRAME_LENGTH];
+
+	size_t len = hdlc::encode(frame, sizeof(frame), control, information, length);
+	serial_write(reinterpret_cast<char const *>(frame), len);
+	serial_.flush();
+	awaiting_reply_ = true;
+}
+
+/* Receive the response to the frame sent last. Its information stays valid until the
+ * next exchange. */
+MeterReader::Status MeterReader::hdlc_receive(hdlc::Frame &reply)
+{
+	static uint8_t frame[hdlc::MAX_FRAME_LENGTH];
+	awaiting_reply_ = false;
+
+	size_t len = serial_read(frame, 3, SERIAL_TIMEOUT * 1000);
+	if(len && !trace_.first_byte) trace_.first_byte = micros();
+	size_t frame_length = len == 3 ? hdlc::frame_length(frame) : 0;
+	if(!frame_length || frame_length > sizeof(frame))
+	{
+		logger::err("no frame or unsupported frame format");
+		return Status::ProtocolError;
+	}
+
+	len += serial_read(&frame[3], frame_length - 3, inter_byte_timeout());
+	switch(hdlc::decode(frame, len, reply))
+	{
+		case hdlc::Result::Ok:
+			break;
+		case hdlc::Result::BadFormat:
+			logger::err("malformed frame (%u bytes)", len);
+			return Status::ProtocolError;
+		case hdlc::Result::BadChecksum:
+			logger::err("frame check sequence mismatch");
+			return Status::ChecksumError;
+	}
+
+	if(reply.destination != hdlc::CLIENT_ADDRESS || reply.source != hdlc::SERVER_ADDRESS)
+	{
+		logger::err("frame for %02" PRIx8 " from %02" PRIx8, reply.destination, reply.source);
+		return Status::ProtocolError;
+	}
+
+	return Status::Ok;
+}
+
+/* Send an APDU in an information frame */
+void MeterReader::send_apdu(uint8_t const *apdu, size_t length)
+{
+	uint8_t information[hdlc::MAX_INFORMATION_LENGTH];
+	size_t const LLC_LENGTH = sizeof(dlms::LLC_REQUEST);
+	memcpy(information, dlms::LLC_REQUEST, LLC_LENGTH);
+	memcpy(&information[LLC_LENGTH], apdu, length);
+
+	hdlc_send(hdlc::information_control(send_sequence_, receive_sequence_), information, LLC_LENGTH + length);
+}
+
+/* Receive the response APDU to the one sent last */
+MeterReader::Status MeterReader::receive_apdu(hdlc::Frame &reply)
+{
+	size_t const LLC_LENGTH = sizeof(dlms::LLC_RESPONSE);
+	Status status = hdlc_receive(reply);
+	if(status != Status::Ok) return status;
+
+	if(!hdlc::is_information(reply.control) || reply.length < LLC_LENGTH ||
+	   memcmp(reply.information, dlms::LLC_RESPONSE, LLC_LENGTH))
+	{
+		logger::err("expected an information frame, got %02" PRIx8, reply.control);
+		return Status::ProtocolError;
+	}
+
+	send_sequence_ = (send_sequence_ + 1) & 0x07;
+	receive_sequence_ = (receive_sequence_ + 1) & 0x07;
+	reply.information += LLC_LENGTH;
+	reply.length -= LLC_LENGTH;
+	return Status::Ok;
+}
+
+void MeterReader::hdlc_connect()
+{
+	if(!awaiting_reply_) return hdlc_send(hdlc::SNRM, nullptr, 0);
+
+	hdlc::Frame reply;
+	Status status = hdlc_receive(reply);
+	if(status != Status::Ok) return change_status(status);
+	if(reply.control != hdlc::UA)
 	{
-		checksum_ ^= line[i];
+		logger::err("connection refused (%02" PRIx8 ")", reply.control);
+		return change_status(Status::ProtocolError);
 	}
-	/* readBytesUntil doesn't include the terminator, so take it into account separately */
-	checksum_ ^= '\n';
 
-	line[len - 1] = 0; /* Cut off \r before logging the line */
-	logger::debug("line: %s", line);
+	step_ = Step::Associate;
+}
 
-	if(line[len - 2] == '!') /* End of data, ETX and checksum will follow */
+void MeterReader::associate()
+{
+	if(!awaiting_reply_)
 	{
-		step_ = Step::AfterData;
+		uint8_t aarq[32];
+		size_t len = dlms::encode_aarq(aarq, sizeof(aarq));
+		return send_apdu(aarq, len);
 	}
-	else /* Data line */
+
+	hdlc::Frame reply;
+	Status status = receive_apdu(reply);
+	if(status != Status::Ok) return change_status(status);
+	if(!dlms::aare_accepted(reply.information, reply.length))
 	{
-		std::string_view line_view(line, len);
-		if(line_view[0] == STX) /* The first data line starts with an STX, remove it */
-			line_view.remove_prefix(1);
+		logger::err("association rejected");
+		return change_status(Status::ProtocolError);
+	}
 
-		auto lparen = line_view.find_first_of('(');
-		auto rparen = line_view.find_last_of(')');
-		if(lparen != std::string_view::npos && rparen != std::string_view::npos)
+	next_object_ = values_.begin();
+	attribute_ = dlms::REGISTER_SCALER_UNIT;
+	step_ = Step::ReadRegister;
+}
+
+/* Read the scaler and unit (unless they're known from an earlier readout), then the value
+ * of the next monitored object */
+void MeterReader::read_register()
+{
+	if(!awaiting_reply_)
+	{
+		uint8_t obis[6];
+		for(; next_object_ != values_.end(); ++next_object_)
 		{
-			auto obis = line_view.substr(0, lparen);
-			auto value = line_view.substr(lparen + 1, rparen - (lparen + 1));
-			handle_object(obis, value);
+			if(dlms::parse_obis(next_object_->first, obis)) break;
+			logger::warn("can't read %s in mode E", next_object_->first.c_str());
 		}
-		else
+		if(next_object_ == values_.end())
 		{
-			logger::warn("improper data line format");
+			step_ = Step::Disconnect;
+			return;
 		}
+
+		if(attribute_ == dlms::REGISTER_SCALER_UNIT && scaler_units_.count(next_object_->first))
+			attribute_ = dlms::REGISTER_VALUE;
+		uint8_t request[16];
+		size_t len = dlms::encode_get_request(request, sizeof(request), dlms::REGISTER_CLASS, obis, attribute_);
+		return send_apdu(request, len);
 	}
+
+	std::string const &obis_text = next_object_->first;
+	hdlc::Frame reply;
+	Status status = receive_apdu(reply);
+	if(status != Status::Ok) return change_status(status);
+
+	dlms::Data data;
+	dlms::GetResult result = dlms::parse_get_response(reply.information, reply.length, data);
+	if(result == dlms::GetResult::Malformed)
+	{
+		logger::err("malformed GET response");
+		return change_status(Status::ProtocolError);
+	}
+
+	if(attribute_ == dlms::REGISTER_SCALER_UNIT)
+	{
+		/* Objects without a scaler and unit are read as they are */
+		bool has_scaler_unit = result == dlms::GetResult::Ok && data.type == dlms::Data::Type::ScalerUnit;
+		ScalerUnit &scaler_unit = scaler_units_[obis_text];
+		scaler_unit.scaler = has_scaler_unit ? data.scaler : 0;
+		scaler_unit.unit = has_scaler_unit ? data.unit : dlms::NO_UNIT;
+#ifdef STRIP_UNIT
+		scaler_unit.unit = dlms::NO_UNIT;
+#endif
+		attribute_ = dlms::REGISTER_VALUE;
+		return;
+	}
+
+	if(result != dlms::GetResult::Ok)
+	{
+		logger::warn("%s: access denied or undefined", obis_text.c_str());
+	}
+	else if(data.type == dlms::Data::Type::Integer)
+	{
+		ScalerUnit const &scaler_unit = scaler_units_[obis_text];
+		char value[MAX_VALUE_LENGTH + 1];
+		dlms::format_value(value, sizeof(value), data.integer, scaler_unit.scaler, scaler_unit.unit);
+		next_object_->second = value;
+	}
+	else if(data.type == dlms::Data::Type::String)
+	{
+		next_object_->second = data.string;
+	}
+	else
+	{
+		logger::warn("%s: unsupported data type", obis_text.c_str());
+	}
+
+	++next_object_;
+	attribute_ = dlms::REGISTER_SCALER_UNIT;
 }
 
-static void postprocess_value(std::string_view &value)
+void MeterReader::disconnect()
 {
-#ifdef STRIP_UNIT
-	size_t unit_sep_pos = value.find_last_of(UNIT_SEPARATOR);
-	if(unit_sep_pos != std::string_view::npos)
-		value.remove_suffix(value.size() - unit_sep_pos);
+	if(!awaiting_reply_) return hdlc_send(hdlc::DISC, nullptr, 0);
+
+	/* The values have been read already, a failure here doesn't change that */
+	hdlc::Frame reply;
+	if(hdlc_receive(reply) != Status::Ok || (reply.control != hdlc::UA && reply.control != hdlc::DM))
+		logger::warn("disconnect failed");
+
+	trace_.checksum_verified = micros();
+	return change_status(Status::Ok);
+}
+
+void MeterReader::serial_begin(uint32_t baud, SerialConfig config, SerialMode mode)
+{
+	serial_.begin(baud, config, mode);
+#ifdef ARDUINO_ARCH_ESP8266
+	if(rx_ring_ && mode != SERIAL_TX_ONLY) rx_ring_->attach(rx_ring_uart_);
 #endif
+	baud_ = baud;
+	if(capture_) capture_->record_baud(baud, config, mode, micros());
 }
 
-void MeterReader::handle_object(std::string_view obis, std::string_view value)
+void MeterReader::serial_write(char const *data, size_t length)
 {
-	auto entry = values_.find(std::string(obis)); /* TODO avoid copy? */
-	if(entry != values_.end())
+	serial_.write(reinterpret_cast<uint8_t const *>(data), length);
+	if(capture_) capture_->record_tx(reinterpret_cast<uint8_t const *>(data), length, micros());
+}
+
+size_t MeterReader::serial_read_until(char terminator, char *buffer, size_t length, uint32_t first_byte_timeout_us)
+{
+	return receive(reinterpret_cast<uint8_t *>(buffer), length, static_cast<uint8_t>(terminator),
+	               first_byte_timeout_us);
+}
+
+size_t MeterReader::serial_read(uint8_t *buffer, size_t length, uint32_t first_byte_timeout_us)
+{
+	return receive(buffer, length, -1, first_byte_timeout_us);
+}
+
+/* Read up to length bytes, stopping after the terminator (unless it's -1) */
+size_t MeterReader::receive(uint8_t *buffer, size_t length, int terminator, uint32_t first_byte_timeout_us)
+{
+	size_t len = 0;
+	uint32_t timeout_us = first_byte_timeout_us;
+	uint32_t last_byte = wait_start();
+	uint8_t rx_flags = 0;
+	while(len < length)
 	{
-		postprocess_value(value);
+		uint8_t flags = 0;
+		int c = rx_ring_ ? rx_ring_->read(&flags) : serial_.read();
+		uint32_t now = micros();
+		if(c < 0)
+		{
+			if(now - last_byte >= timeout_us)
+			{
+				account_timeout(now - last_byte);
+				break;
+			}
+			yield();
+			continue;
+		}
+
+		/* Only gaps between bytes count, not the wait for the first one, unless it follows
+		 * earlier bytes of the data block */
+		if(len || block_last_byte_)
+		{
+			uint32_t gap_bits = static_cast<uint64_t>(now - (len ? last_byte : block_last_byte_)) * baud_ / 1000000;
+			if(gap_bits > max_gap_bits_) max_gap_bits_ = gap_bits;
+		}
+		last_byte = now;
+		if(block_last_byte_) block_last_byte_ = now;
+		timeout_us = inter_byte_timeout();
 
-		if(is_valid_object_value(value))
-			entry->second = value;
+		buffer[len++] = c;
+		rx_flags |= flags;
+		if(c == terminator) break;
 	}
+
+	account_received(buffer, len, rx_flags);
+	return len;
 }
 
-void MeterReader::verify_checksum()
+std::string_view MeterReader::receive_line(char *scratch, size_t length, uint32_t first_byte_timeout_us)
 {
-	/* Expecting ETX and then the checksum */
-	uint8_t etx_bcc[2];
-	if(serial_.readBytes(etx_bcc, 2) != 2 || etx_bcc[0] != ETX)
+	/* The ring timestamps the bytes as they arrive, so the gaps don't have to be measured
+	 * by polling. Lines are only read within the data block, so the gaps between them count
+	 * too. */
+	uint32_t start = wait_start();
+	std::string_view line;
+	uint8_t rx_flags = 0;
+	while(!rx_ring_->peek_line(length, scratch, line, rx_flags))
 	{
-		logger::err("failed to read checksum");
-		return change_status(Status::ProtocolError);
+		size_t available = rx_ring_->available();
+		uint32_t now = micros();
+		uint32_t waited_us = available ? now - rx_ring_->last_byte_us() : now - start;
+		if(waited_us >= (available ? inter_byte_timeout() : first_byte_timeout_us))
+		{
+			account_timeout(waited_us);
+			rx_ring_->peek_line(available, scratch, line, rx_flags); /* What there is */
+			break;
+		}
+		yield();
 	}
 
-	checksum_ ^= ETX;
-	if(checksum_ != etx_bcc[1])
+	uint32_t gap_bits = static_cast<uint64_t>(rx_ring_->take_max_gap_us(false)) * baud_ / 1000000;
+	if(gap_bits > max_gap_bits_) max_gap_bits_ = gap_bits;
+	if(!line.empty()) block_last_byte_ = rx_ring_->last_byte_us();
+
+	account_received(reinterpret_cast<uint8_t const *>(line.data()), line.size(), rx_flags);
+	return line;
+}
+
+/* Update the receive statistics and the capture after a read */
+void MeterReader::account_received(uint8_t const *data, size_t length, uint8_t rx_flags)
+{
+	bytes_received_ += length;
+	if(capture_ && length) capture_->record_rx(data, length, micros());
+
+	if(rx_ring_)
 	{
-		logger::err("checksum mismatch: %02" PRIx8 " != %02" PRIx8, checksum_, etx_bcc[1]);
-		return change_status(Status::ChecksumError);
+		if(rx_flags) ++rx_errors_;
+		uint32_t overruns = rx_ring_->stats().overruns + rx_ring_->stats().fifo_overruns;
+		if(overruns != rx_ring_overruns_) ++rx_overruns_;
+		rx_ring_overruns_ = overruns;
+		return;
 	}
 
-	return change_status(Status::Ok); /* Data readout successful */
+	if(serial_.hasRxError()) ++rx_errors_;
+	if(serial_.hasOverrun()) ++rx_overruns_;
 }
 
 void MeterReader::change_status(Status to)
@@ -224,8 +640,17 @@ void MeterReader::change_status(Status to)
 	else if(to == Status::ChecksumError)
 		++checksum_errors_;
 	else if(to == Status::Ok)
+	{
 		++successes_;
+		/* Follow longer gaps right away, shorter ones slowly */
+		if(!gap_learned_ || max_gap_bits_ > learned_gap_bits_)
+			learned_gap_bits_ = max_gap_bits_;
+		else
+			learned_gap_bits_ -= (learned_gap_bits_ - max_gap_bits_) / 8;
+		gap_learned_ = true;
+	}
 
+	block_last_byte_ = 0;
 	status_ = to;
 }
 
@@ -243,6 +668,7 @@ bool MeterReader::stop_monitoring(std::string_view obis)
 	/* Don't allow removing a monitored object in the middle of a readout */
 	if(status_ == Status::Busy) return false;
 
+	scaler_units_.erase(std::string(obis));
 	return values_.erase(std::string(obis)) == 1;
 }
 
@@ -253,12 +679,32 @@ void MeterReader::start_reading()
 
 	status_ = Status::Busy;
 	step_ = Step::Started;
+	trace_ = {trace_.sequence + 1, 0, 0, 0};
+	timed_out_ = false;
+	max_gap_bits_ = 0;
+	block_last_byte_ = 0;
+	waiting_ = false;
+	awaiting_reply_ = false;
+	/* Whatever is left over from an aborted readout isn't part of this one */
+	if(rx_ring_) rx_ring_->clear();
 }
 
 void MeterReader::loop()
 {
 	if(status_ != Status::Busy) return;
 
+	/* Rather than block, come back when data has arrived. Once the step's timeout has
+	 * passed, run it anyway, its read then times out right away. */
+	if(waiting_for_data())
+	{
+		if(!waiting_)
+		{
+			waiting_ = true;
+			waiting_since_ = micros();
+		}
+		if(micros() - waiting_since_ < step_timeout_us()) return;
+	}
+
 	switch(step_)
 	{
 		case Step::Ready: /* nothing to do, this should never happen */
@@ -278,5 +724,17 @@ void MeterReader::loop()
 		case Step::AfterData:
 			verify_checksum();
 			break;
+		case Step::HdlcConnect:
+			hdlc_connect();
+			break;
+		case Step::Associate:
+			associate();
+			break;
+		case Step::ReadRegister:
+			read_register();
+			break;
+		case Step::Disconnect:
+			disconnect();
+			break;
 	}
 }
\ No newline at end of file
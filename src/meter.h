@@ -9,6 +9,10 @@
 
 #include <HardwareSerial.h>
 
+#include "capture.h"
+#include "hdlc.h"
+#include "rx_ring.h"
+
 size_t const MAX_OBIS_CODE_LENGTH = 16;
 size_t const MAX_IDENTIFICATION_LENGTH = 5 + 16 + 1; /* /AAAbi...i\r */
 size_t const MAX_VALUE_LENGTH = 32 + 1 + 16 + 1;     /* value: 32, *, unit: 16 */
@@ -28,6 +32,15 @@ public:
 		ChecksumError,
 	};
 
+	/* Timestamps (micros()) of the milestones of a single readout */
+	struct Trace
+	{
+		uint32_t sequence;          /* Incremented on every started readout */
+		uint32_t request_sent;      /* Request message written out */
+		uint32_t first_byte;        /* First byte of the data block available */
+		uint32_t checksum_verified; /* BCC matched, values committed */
+	};
+
 	explicit MeterReader(HardwareSerial &serial) : serial_(serial) {}
 	MeterReader(MeterReader const &) = delete;
 	MeterReader(MeterReader &&) = delete;
@@ -40,8 +53,12 @@ public:
 	bool stop_monitoring(std::string_view obis);
 
 	void start_reading();
-	/* Must be called frequently to advance the reading process */
+	/* Must be called frequently to advance the reading process. Doesn't block while
+	 * waiting for the meter to start sending. */
 	void loop();
+	/* While waiting for the meter, how long (ms) until loop() has to be called again if no
+	 * data arrives before; 0 if loop() has more to do right away */
+	uint32_t wait_ms() const;
 	Status status() const { return status_; }
 	/* Call this after status() returns Ok or an error to reset it to Ready */
 	void acknowledge()
@@ -52,8 +69,35 @@ public:
 	size_t errors() const { return errors_; }
 	size_t checksum_errors() const { return checksum_errors_; }
 	size_t successes() const { return successes_; }
+	size_t bytes_received() const { return bytes_received_; }
+	/* Number of reads during which a parity/framing error or an RX buffer overrun occurred */
+	size_t rx_errors() const { return rx_errors_; }
+	size_t rx_overruns() const { return rx_overruns_; }
+	/* Number of reads that gave up waiting for the meter, and the time spent waiting in them */
+	size_t timeouts() const { return timeouts_; }
+	uint32_t timeout_time() const { return timeout_ms_; } /* ms */
+	/* Whether the last readout failed because the meter stopped sending */
+	bool timed_out() const { return timed_out_; }
+	/* How long to wait for the next byte once the meter has started sending, from the baud
+	 * rate and the gaps between bytes seen during successful readouts */
+	uint32_t inter_byte_timeout() const; /* us */
 
 	std::map<std::string, std::string> const &values() const { return values_; }
+	/* Trace of the last (or current) readout */
+	Trace const &trace() const { return trace_; }
+
+	/* Record the serial traffic of every readout into the capture (nullptr to stop). The
+	 * capture is cleared when a readout starts. */
+	void set_capture(Capture *capture) { capture_ = capture; }
+	/* Receive through a ring filled by the UART interrupt (see rx_ring.h) instead of the
+	 * serial driver's buffer. uart_nr is the UART that the serial port uses. */
+	void set_rx_ring(RxRing *ring, int uart_nr)
+	{
+		rx_ring_ = ring;
+		rx_ring_uart_ = uart_nr;
+	}
+	/* Bytes received from the meter that haven't been read yet */
+	size_t available() const { return rx_ring_ ? rx_ring_->available() : serial_.available(); }
 
 private:
 	enum class Step : uint8_t;
@@ -65,7 +109,41 @@ private:
 	void handle_object(std::string_view obis, std::string_view value);
 	void verify_checksum();
 
+	/* Protocol mode E */
+	void hdlc_connect();
+	void associate();
+	void read_register();
+	void disconnect();
+	/* Each step sends its request and returns, the response is received when the step runs
+	 * again */
+	void hdlc_send(uint8_t control, uint8_t const *information, size_t length);
+	Status hdlc_receive(hdlc::Frame &reply);
+	void send_apdu(uint8_t const *apdu, size_t length);
+	Status receive_apdu(hdlc::Frame &reply);
+
 	void change_status(Status to);
+	bool wait_available(uint32_t timeout_us);
+	/* The current step can't do anything until data arrives */
+	bool waiting_for_data() const;
+	uint32_t step_timeout_us() const;
+	/* micros() when the wait for the next read began: now, unless loop() has waited before
+	 * running the step */
+	uint32_t wait_start();
+	void account_timeout(uint32_t waited_us);
+
+	/* Serial port access, recorded into the capture if there is one */
+	void serial_begin(uint32_t baud, SerialConfig config, SerialMode mode = SERIAL_FULL);
+	void serial_write(char const *data, size_t length);
+	/* Like Stream::readBytesUntil, but the terminator is kept in the buffer if it was read.
+	 * The first byte is waited for for up to first_byte_timeout, the ones after it for up
+	 * to inter_byte_timeout(). */
+	size_t serial_read_until(char terminator, char *buffer, size_t length, uint32_t first_byte_timeout_us);
+	size_t serial_read(uint8_t *buffer, size_t length, uint32_t first_byte_timeout_us);
+	size_t receive(uint8_t *buffer, size_t length, int terminator, uint32_t first_byte_timeout_us);
+	/* Like serial_read_until('\n', ...), but the line is left in the RX ring, which has to be
+	 * consumed after it's been handled */
+	std::string_view receive_line(char *scratch, size_t length, uint32_t first_byte_timeout_us);
+	void account_received(uint8_t const *data, size_t length, uint8_t rx_flags);
 
 	HardwareSerial &serial_;
 	Step step_;
@@ -73,6 +151,40 @@ private:
 	uint8_t baud_char_, checksum_;
 	std::map<std::string, std::string> values_;
 	size_t errors_ = 0, checksum_errors_ = 0, successes_ = 0;
+	size_t bytes_received_ = 0, rx_errors_ = 0, rx_overruns_ = 0;
+	size_t timeouts_ = 0;
+	uint32_t timeout_ms_ = 0;
+	bool timed_out_ = false;
+	uint32_t baud_ = INITIAL_BAUD_RATE;
+	/* Longest gap between two bytes of a read, in bit times: in this readout, and learned
+	 * from the successful ones */
+	uint32_t max_gap_bits_ = 0, learned_gap_bits_ = 0;
+	bool gap_learned_ = false;
+	/* micros() of the last byte of the data block received so far, 0 outside of it. Within
+	 * the data block, the gaps between lines count as well. */
+	uint32_t block_last_byte_ = 0;
+	/* loop() has been waiting for data since waiting_since_ */
+	bool waiting_ = false;
+	uint32_t waiting_since_;
+	Trace trace_ = {};
+	Capture *capture_ = nullptr;
+	RxRing *rx_ring_ = nullptr;
+	int rx_ring_uart_;
+	uint32_t rx_ring_overruns_ = 0; /* Ring and FIFO overruns already accounted for */
+
+	/* Protocol mode E */
+	bool mode_e_ = false;
+	uint8_t send_sequence_, receive_sequence_;
+	std::map<std::string, std::string>::iterator next_object_;
+	uint8_t attribute_;
+	bool awaiting_reply_ = false; /* The current step has sent its request */
+	struct ScalerUnit
+	{
+		int8_t scaler;
+		uint8_t unit;
+	};
+	/* Registers' scalers and units don't change, they're only read once */
+	std::map<std::string, ScalerUnit> scaler_units_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "metrics.h"
+
+#define METRIC_PREFIX "iec62056_"
+
+namespace metrics
+{
+struct Descriptor
+{
+	char const *name;
+	char const *labels; /* Without braces, nullptr for none */
+	Type type;
+	bool is_signed; /* Render the value as int32_t */
+	char const *help;
+};
+
+static Descriptor const DESCRIPTORS[] = {
+    {"readouts_total", "status=\"ok\"", Type::Counter, false, "Completed readouts by status"},
+    {"readouts_total", "status=\"protocol_error\"", Type::Counter, false, nullptr},
+    {"readouts_total", "status=\"checksum_error\"", Type::Counter, false, nullptr},
+    {"readout_phase_microseconds", "phase=\"first_byte\"", Type::Gauge, false,
+     "Duration of the phases of the last successful readout"},
+    {"readout_phase_microseconds", "phase=\"data_block\"", Type::Gauge, false, nullptr},
+    {"readout_phase_microseconds", "phase=\"publish\"", Type::Gauge, false, nullptr},
+    {"serial_received_bytes_total", nullptr, Type::Counter, false, "Bytes received from the meter"},
+    {"serial_rx_errors_total", nullptr, Type::Counter, false, "Serial reads with a parity or framing error"},
+    {"serial_rx_overruns_total", nullptr, Type::Counter, false, "Serial reads during which the RX buffer overflowed"},
+    {"publish_queue_depth", nullptr, Type::Gauge, false, "Values of the last readout not published yet"},
+    {"heap_free_bytes", nullptr, Type::Gauge, false, "Free heap"},
+    {"heap_fragmentation_percent", nullptr, Type::Gauge, false, "Heap fragmentation"},
+    {"heap_max_block_bytes", nullptr, Type::Gauge, false, "Largest allocatable heap block"},
+    {"wifi_rssi_dbm", nullptr, Type::Gauge, true, "WiFi signal strength"},
+    {"loop_latency_microseconds", nullptr, Type::Gauge, false, "Duration of the last main loop iteration"},
+    {"loop_latency_max_microseconds", nullptr, Type::Gauge, false,
+     "Longest main loop iteration since the last scrape"},
+    {"connection_state", nullptr, Type::Gauge, false,
+     "0: connecting to WiFi, 1: connecting to MQTT, 2: connected, 3: waiting to retry"},
+    {"connection_state_transitions_total", nullptr, Type::Counter, false, "Connection state changes"},
+    {"reconnect_milliseconds", nullptr, Type::Gauge, false,
+     "Time it took to get connected after the connection was last lost"},
+    {"boot_milliseconds", "event=\"connected\"", Type::Gauge, false,
+     "Time from boot until each event first happened"},
+    {"boot_milliseconds", "event=\"first_readout\"", Type::Gauge, false, nullptr},
+    {"boot_milliseconds", "event=\"first_publish\"", Type::Gauge, false, nullptr},
+    {"serial_timeouts_total", nullptr, Type::Counter, false, "Serial reads that gave up waiting for the meter"},
+    {"serial_timeout_milliseconds_total", nullptr, Type::Counter, false, "Time spent in serial reads that timed out"},
+    {"serial_inter_byte_timeout_microseconds", nullptr, Type::Gauge, false,
+     "Current deadline for the next byte once the meter has started sending"},
+    {"aligned_slots_skipped_total", nullptr, Type::Counter, false, "Wall-clock aligned readout slots that were missed"},
+    {"aligned_phase_error_microseconds", nullptr, Type::Gauge, true,
+     "Start of the data block minus the slot boundary, last aligned readout"},
+    {"aligned_jitter_microseconds", nullptr, Type::Gauge, false, "Smoothed change of the phase error between readouts"},
+    {"aligned_lead_microseconds", nullptr, Type::Gauge, false, "How early aligned readouts are started"},
+    {"serial_rx_ring_overruns_total", "buffer=\"ring\"", Type::Counter, false,
+     "Overflows of the RX ring (one per lost byte) and of the UART's FIFO"},
+    {"serial_rx_ring_overruns_total", "buffer=\"fifo\"", Type::Counter, false, nullptr},
+    {"serial_rx_ring_errors_total", "error=\"parity\"", Type::Counter, false, "Bytes received with an error"},
+    {"serial_rx_ring_errors_total", "error=\"framing\"", Type::Counter, false, nullptr},
+    {"serial_rx_ring_high_water_bytes", nullptr, Type::Gauge, false, "Most bytes ever waiting in the RX ring"},
+    {"stream_clients", nullptr, Type::Gauge, false, "Clients connected to the streaming endpoint"},
+    {"stream_frames_total", nullptr, Type::Counter, false, "Readouts queued to streaming clients"},
+    {"stream_disconnects_total", "reason=\"slow\"", Type::Counter, false,
+     "Streaming clients disconnected or refused by the device"},
+    {"stream_disconnects_total", "reason=\"full\"", Type::Counter, false, nullptr},
+    {"loop_over_budget_total", nullptr, Type::Counter, false, "Main loop iterations longer than PROFILE_BUDGET"},
+};
+
+static_assert(sizeof(DESCRIPTORS) / sizeof(DESCRIPTORS[0]) == static_cast<size_t>(Id::Count),
+              "every metric needs a descriptor");
+
+static uint32_t values[static_cast<size_t>(Id::Count)];
+
+void set(Id id, uint32_t value)
+{
+	values[static_cast<size_t>(id)] = value;
+}
+
+void add(Id id, uint32_t delta)
+{
+	values[static_cast<size_t>(id)] += delta;
+}
+
+uint32_t get(Id id)
+{
+	return values[static_cast<size_t>(id)];
+}
+
+void set_max(Id id, uint32_t value)
+{
+	if(value > get(id)) set(id, value);
+}
+
+/* Renders a single metric, including the HELP and TYPE lines if it's the first one with its name.
+ * Returns the number of characters that would have been written, like snprintf. */
+static size_t render_one(char *buffer, size_t size, size_t index)
+{
+	Descriptor const &desc = DESCRIPTORS[index];
+
+	char labels[40] = "";
+	if(desc.labels) snprintf(labels, sizeof(labels), "{%s}", desc.labels);
+
+	char value[12];
+	if(desc.is_signed)
+		snprintf(value, sizeof(value), "%" PRIi32, static_cast<int32_t>(values[index]));
+	else
+		snprintf(value, sizeof(value), "%" PRIu32, values[index]);
+
+	char const *type = desc.type == Type::Counter ? "counter" : "gauge";
+	if(desc.help)
+	{
+		return snprintf(buffer, size,
+		                "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s %s\n" METRIC_PREFIX "%s%s %s\n",
+		                desc.name, desc.help, desc.name, type, desc.name, labels, value);
+	}
+
+	return snprintf(buffer, size, METRIC_PREFIX "%s%s %s\n", desc.name, labels, value);
+}
+
+size_t render(char *buffer, size_t size, size_t &position)
+{
+	size_t len = 0;
+	while(position < static_cast<size_t>(Id::Count))
+	{
+		size_t written = render_one(&buffer[len], size - len, position);
+		if(len + written >= size) break; /* Didn't fit (snprintf needs room for the null terminator) */
+
+		len += written;
+		++position;
+	}
+
+	return len;
+}
+}
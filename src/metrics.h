@@ -0,0 +1,76 @@
+#ifndef IEC62056_MQTT_METRICS_H
+#define IEC62056_MQTT_METRICS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace metrics
+{
+/* Every metric that can be exported. Metrics sharing a name (but with different
+ * labels) must be kept next to each other. */
+enum class Id : uint8_t
+{
+	ReadoutsOk,
+	ReadoutsProtocolError,
+	ReadoutsChecksumError,
+	PhaseFirstByte,
+	PhaseDataBlock,
+	PhasePublish,
+	BytesReceived,
+	RxErrors,
+	RxOverruns,
+	PublishQueueDepth,
+	HeapFree,
+	HeapFragmentation,
+	HeapMaxBlock,
+	Rssi,
+	LoopLatency,
+	LoopLatencyMax,
+	ConnectionState,
+	ConnectionTransitions,
+	ReconnectTime,
+	BootConnected,
+	BootFirstReadout,
+	BootFirstPublish,
+	SerialTimeouts,
+	SerialTimeoutTime,
+	InterByteTimeout,
+	SlotsSkipped,
+	SlotPhaseError,
+	SlotJitter,
+	SlotLead,
+	RxRingOverruns,
+	RxFifoOverruns,
+	RxParityErrors,
+	RxFramingErrors,
+	RxRingHighWater,
+	StreamClients,
+	StreamFrames,
+	StreamDropped,
+	StreamRejected,
+	LoopOverBudget,
+
+	Count
+};
+
+enum class Type : uint8_t
+{
+	Counter,
+	Gauge,
+};
+
+void set(Id id, uint32_t value);
+void add(Id id, uint32_t delta = 1);
+uint32_t get(Id id);
+/* Only sets the value if it's larger than the current one (for maximums) */
+void set_max(Id id, uint32_t value);
+
+/* Renders as many whole lines of the Prometheus text exposition format as fit into
+ * the buffer, starting with the metric at index `position` which is then advanced.
+ * Returns the number of characters written, 0 when all metrics have been rendered.
+ * The output is not null terminated. The buffer should fit at least one metric with its
+ * HELP and TYPE lines (256 characters is plenty). */
+size_t render(char *buffer, size_t size, size_t &position);
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include <cstring>
+#include <vector>
+
+#include "config.h"
+#include "planner.h"
+
+namespace planner
+{
+struct Target
+{
+	char const *obis;
+	uint32_t interval_ms;
+};
+
+#ifdef REFRESH_INTERVALS
+#define REFRESH_INTERVAL(obis, interval_ms) {obis, interval_ms},
+static Target const TARGETS[] = {REFRESH_INTERVALS};
+#undef REFRESH_INTERVAL
+size_t const TARGET_COUNT = sizeof(TARGETS) / sizeof(TARGETS[0]);
+#else
+static Target const *const TARGETS = nullptr;
+size_t const TARGET_COUNT = 0;
+#endif
+
+static std::vector<Object> objects;
+
+static Object *find(char const *obis)
+{
+	for(Object &object : objects)
+	{
+		if(!strcmp(object.obis, obis)) return &object;
+	}
+	return nullptr;
+}
+
+void add(char const *obis)
+{
+	if(find(obis)) return;
+
+	uint32_t target_ms = 0;
+	for(size_t i = 0; i < TARGET_COUNT; ++i)
+	{
+		if(!strcmp(TARGETS[i].obis, obis)) target_ms = TARGETS[i].interval_ms;
+	}
+	objects.push_back({obis, target_ms, 0, 0, 0, 0});
+}
+
+bool due(char const *obis, uint32_t now_ms)
+{
+	Object const *object = find(obis);
+	return !object || !object->publishes || now_ms - object->last_publish_ms >= object->target_ms;
+}
+
+void published(char const *obis, uint32_t now_ms)
+{
+	Object *object = find(obis);
+	if(!object) return;
+
+	if(object->publishes)
+	{
+		object->interval_ms = now_ms - object->last_publish_ms;
+		if(object->interval_ms > object->max_interval_ms) object->max_interval_ms = object->interval_ms;
+	}
+	object->last_publish_ms = now_ms;
+	++object->publishes;
+}
+
+uint32_t time_until_due(uint32_t now_ms, uint32_t readout_ms)
+{
+	uint32_t soonest = UINT32_MAX;
+	for(Object const &object : objects)
+	{
+		if(!object.publishes) return 0;
+
+		uint32_t age = now_ms - object.last_publish_ms;
+		if(age + readout_ms >= object.target_ms) return 0;
+		if(object.target_ms - readout_ms - age < soonest) soonest = object.target_ms - readout_ms - age;
+	}
+	return soonest == UINT32_MAX ? 0 : soonest;
+}
+
+size_t count()
+{
+	return objects.size();
+}
+
+Object const &object(size_t index)
+{
+	return objects[index];
+}
+}
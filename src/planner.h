@@ -0,0 +1,39 @@
+#ifndef IEC62056_MQTT_PLANNER_H
+#define IEC62056_MQTT_PLANNER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* Decides which of the published objects are due after a readout, and when the next
+ * readout has to start, from the target refresh intervals in REFRESH_INTERVALS. Objects
+ * without a target are refreshed with every readout. */
+namespace planner
+{
+struct Object
+{
+	char const *obis;
+	uint32_t target_ms;       /* 0: every readout */
+	uint32_t last_publish_ms; /* Completion time of the readout whose value was last published */
+	uint32_t interval_ms;     /* Achieved: between the last two published values */
+	uint32_t max_interval_ms;
+	uint32_t publishes;
+};
+
+/* Start planning for a published object */
+void add(char const *obis);
+
+/* Whether an object's value from a readout that completed at now_ms should be published.
+ * Objects that weren't added are always due. */
+bool due(char const *obis, uint32_t now_ms);
+/* Record that the value of an object from a readout that completed at now_ms was published */
+void published(char const *obis, uint32_t now_ms);
+
+/* How long until the next readout has to start for the first object to become due by
+ * the time it completes, given how long a readout takes */
+uint32_t time_until_due(uint32_t now_ms, uint32_t readout_ms);
+
+size_t count();
+Object const &object(size_t index);
+}
+
+#endif
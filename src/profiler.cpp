@@ -0,0 +1,274 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+namespace profiler
+{
+#ifdef PROFILE_LOOP
+size_t const MAX_SUBSYSTEMS = 16;
+size_t const MAX_BREAKDOWN = 24; /* Runs recorded per iteration */
+
+/* Run times are counted in a histogram with 4 buckets per power of two from 2^8 cycles
+ * (3.2 us at 80 MHz) up, which puts the percentiles within 19% */
+unsigned const MIN_OCTAVE = 8;
+unsigned const SUB_BUCKET_BITS = 2;
+size_t const BUCKETS = 1 + ((32 - MIN_OCTAVE) << SUB_BUCKET_BITS);
+
+struct Subsystem
+{
+	void const *id; /* The task, or the section's name */
+	char const *name;
+	bool nested; /* A section, counted in the task that ran it as well */
+
+	/* Current window */
+	uint32_t runs, max_cycles;
+	uint64_t total_cycles;
+	uint16_t histogram[BUCKETS];
+
+	/* Last complete window */
+	struct
+	{
+		uint32_t runs, max_us, p99_us;
+		uint16_t share; /* Of the window, in hundredths of a percent */
+	} last;
+};
+
+struct Run
+{
+	uint8_t subsystem;
+	uint32_t cycles;
+};
+
+struct Iteration
+{
+	uint32_t cycles;
+	uint32_t at_ms;
+	size_t count;
+	Run runs[MAX_BREAKDOWN];
+};
+
+static Subsystem subsystems[MAX_SUBSYSTEMS];
+static size_t subsystem_count;
+
+static uint32_t iteration_start;
+static Iteration current;
+/* Slowest iteration over the budget, of the current and of the last window */
+static Iteration slowest, last_slowest;
+
+static uint32_t window_start_ms;
+static uint32_t iterations, window_over_budget;
+static struct
+{
+	uint32_t iterations, over_budget, length_ms;
+} last_window;
+static uint32_t total_over_budget;
+
+static size_t bucket(uint32_t cycles)
+{
+	if(cycles < (1u << MIN_OCTAVE)) return 0;
+
+	unsigned octave = 31 - __builtin_clz(cycles);
+	unsigned sub_bucket = (cycles >> (octave - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+	return 1 + ((octave - MIN_OCTAVE) << SUB_BUCKET_BITS) + sub_bucket;
+}
+
+/* The largest value that falls into a bucket */
+static uint32_t bucket_limit(size_t index)
+{
+	if(!index) return (1u << MIN_OCTAVE) - 1;
+
+	unsigned octave = MIN_OCTAVE + ((index - 1) >> SUB_BUCKET_BITS);
+	uint64_t sub_bucket = (index - 1) & ((1 << SUB_BUCKET_BITS) - 1);
+	return ((1ull << octave) + ((sub_bucket + 1) << (octave - SUB_BUCKET_BITS))) - 1;
+}
+
+static Subsystem *find(void const *id, char const *name, bool nested)
+{
+	for(size_t i = 0; i < subsystem_count; ++i)
+	{
+		if(subsystems[i].id == id) return &subsystems[i];
+	}
+	if(subsystem_count == MAX_SUBSYSTEMS) return nullptr;
+
+	Subsystem &subsystem = subsystems[subsystem_count++];
+	subsystem.id = id;
+	subsystem.name = name;
+	subsystem.nested = nested;
+	return &subsystem;
+}
+
+static void record(Subsystem *subsystem, uint32_t cycles)
+{
+	if(!subsystem) return;
+
+	++subsystem->runs;
+	subsystem->total_cycles += cycles;
+	if(cycles > subsystem->max_cycles) subsystem->max_cycles = cycles;
+	uint16_t &count = subsystem->histogram[bucket(cycles)];
+	if(count < UINT16_MAX) ++count;
+
+	if(current.count < MAX_BREAKDOWN)
+		current.runs[current.count++] = {static_cast<uint8_t>(subsystem - subsystems), cycles};
+}
+
+/* Summarize the window that just ended and start a new one */
+static void roll_window(uint32_t now_ms)
+{
+	uint32_t mhz = ESP.getCpuFreqMHz();
+	uint32_t length_ms = now_ms - window_start_ms;
+	uint64_t window_cycles = static_cast<uint64_t>(length_ms) * mhz * 1000;
+
+	for(size_t i = 0; i < subsystem_count; ++i)
+	{
+		Subsystem &subsystem = subsystems[i];
+		subsystem.last.runs = subsystem.runs;
+		subsystem.last.max_us = subsystem.max_cycles / mhz;
+		subsystem.last.share = window_cycles ? subsystem.total_cycles * 10000 / window_cycles : 0;
+
+		/* The run at the 99th percentile, rounded up */
+		uint32_t rank = subsystem.runs - subsystem.runs / 100, seen = 0;
+		subsystem.last.p99_us = 0;
+		for(size_t b = 0; b < BUCKETS && subsystem.runs; ++b)
+		{
+			seen += subsystem.histogram[b];
+			if(seen >= rank)
+			{
+				uint32_t limit = bucket_limit(b);
+				subsystem.last.p99_us = (limit < subsystem.max_cycles ? limit : subsystem.max_cycles) / mhz;
+				break;
+			}
+		}
+
+		subsystem.runs = subsystem.max_cycles = 0;
+		subsystem.total_cycles = 0;
+		memset(subsystem.histogram, 0, sizeof(subsystem.histogram));
+	}
+
+	last_window = {iterations, window_over_budget, length_ms};
+	last_slowest = slowest;
+	slowest.cycles = 0;
+	slowest.count = 0;
+	iterations = window_over_budget = 0;
+	window_start_ms = now_ms;
+}
+#endif
+
+void iteration_started()
+{
+#ifdef PROFILE_LOOP
+	current.count = 0;
+	iteration_start = ESP.getCycleCount();
+#endif
+}
+
+void iteration_finished()
+{
+#ifdef PROFILE_LOOP
+	current.cycles = ESP.getCycleCount() - iteration_start;
+	++iterations;
+	if(current.cycles > PROFILE_BUDGET * ESP.getCpuFreqMHz())
+	{
+		++window_over_budget;
+		++total_over_budget;
+		if(current.cycles > slowest.cycles)
+		{
+			current.at_ms = millis();
+			slowest = current;
+		}
+	}
+
+	uint32_t now_ms = millis();
+	if(now_ms - window_start_ms >= PROFILE_WINDOW) roll_window(now_ms);
+#endif
+}
+
+void task_ran(Task const &task, uint32_t cycles)
+{
+#ifdef PROFILE_LOOP
+	record(find(&task, task.name, false), cycles);
+#else
+	(void)task;
+	(void)cycles;
+#endif
+}
+
+uint32_t section_started()
+{
+#ifdef PROFILE_LOOP
+	return ESP.getCycleCount();
+#else
+	return 0;
+#endif
+}
+
+void section_finished(char const *name, uint32_t start_cycles)
+{
+#ifdef PROFILE_LOOP
+	record(find(name, name, true), ESP.getCycleCount() - start_cycles);
+#else
+	(void)name;
+	(void)start_cycles;
+#endif
+}
+
+uint32_t over_budget()
+{
+#ifdef PROFILE_LOOP
+	return total_over_budget;
+#else
+	return 0;
+#endif
+}
+
+size_t report(char *buffer, size_t size)
+{
+	size_t len = 0;
+	auto append = [&](char const *format, auto... args) {
+		if(len < size) len += snprintf(&buffer[len], size - len, format, args...);
+	};
+
+#ifdef PROFILE_LOOP
+	if(!last_window.length_ms)
+	{
+		append("no complete window yet (%" PRIu32 " ms)\n", PROFILE_WINDOW);
+		return len < size ? len : size - 1;
+	}
+
+	append("window %" PRIu32 " ms: %" PRIu32 " iterations, %" PRIu32 " over %" PRIu32 " us\n", last_window.length_ms,
+	       last_window.iterations, last_window.over_budget, PROFILE_BUDGET);
+	append("%-12s %8s %7s %9s %9s\n", "subsystem", "runs", "share%", "max_us", "p99_us");
+	for(size_t i = 0; i < subsystem_count; ++i)
+	{
+		Subsystem const &subsystem = subsystems[i];
+		char name[24];
+		snprintf(name, sizeof(name), "%s%s", subsystem.name, subsystem.nested ? "*" : "");
+		append("%-12s %8" PRIu32 " %4u.%02u %9" PRIu32 " %9" PRIu32 "\n", name, subsystem.last.runs,
+		       subsystem.last.share / 100, subsystem.last.share % 100, subsystem.last.max_us, subsystem.last.p99_us);
+	}
+	append("(* part of the task that ran it)\n");
+
+	if(last_slowest.cycles)
+	{
+		uint32_t mhz = ESP.getCpuFreqMHz();
+		append("slowest iteration: %" PRIu32 " us at %" PRIu32 " ms:", last_slowest.cycles / mhz, last_slowest.at_ms);
+		for(size_t i = 0; i < last_slowest.count; ++i)
+		{
+			Run const &run = last_slowest.runs[i];
+			append(" %s%s %" PRIu32, subsystems[run.subsystem].name, subsystems[run.subsystem].nested ? "*" : "",
+			       run.cycles / mhz);
+		}
+		append("\n");
+	}
+#else
+	append("profiling is disabled (PROFILE_LOOP)\n");
+#endif
+
+	return len < size ? len : size - 1;
+}
+}
@@ -0,0 +1,48 @@
+#ifndef IEC62056_MQTT_PROFILER_H
+#define IEC62056_MQTT_PROFILER_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct Task;
+
+/* Counts the CPU cycles spent in every scheduler task, and in sections of code within
+ * them (such as publishing), per main loop iteration. Keeps the runs, share of the time,
+ * maximum and 99th percentile of each over windows of PROFILE_WINDOW, and the breakdown
+ * of the slowest iteration that went over PROFILE_BUDGET. Does nothing unless
+ * PROFILE_LOOP is defined. */
+namespace profiler
+{
+/* Bracket an iteration of the main loop */
+void iteration_started();
+void iteration_finished();
+
+/* Record a task run (see scheduler::on_task_run) */
+void task_ran(Task const &task, uint32_t cycles);
+
+uint32_t section_started();
+void section_finished(char const *name, uint32_t start_cycles);
+
+/* Profiles the code in its scope as a part of whatever task runs it. The name must be a
+ * string literal: sections are told apart by its address. */
+class Section
+{
+public:
+	explicit Section(char const *name) : name_(name), start_(section_started()) {}
+	~Section() { section_finished(name_, start_); }
+	Section(Section const &) = delete;
+
+private:
+	char const *name_;
+	uint32_t start_;
+};
+
+/* Iterations that went over the budget, since boot */
+uint32_t over_budget();
+
+/* Render a report of the last complete window as text, at most size - 1 characters.
+ * Returns the length. */
+size_t report(char *buffer, size_t size);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "pulse.h"
+
+/* Below this many pulses between two calibrations the register's resolution dominates */
+uint32_t const MIN_CALIBRATION_PULSES = 1000;
+/* Corrections outside of this range are assumed to be caused by missed readouts or
+ * a misconfigured meter constant and ignored */
+Fixed const MAX_CORRECTION_DEVIATION = FIXED_ONE / 10;
+
+bool PulseEstimator::pulse(uint32_t timestamp_us)
+{
+	if(have_pulse_)
+	{
+		uint32_t interval = timestamp_us - last_us_;
+		if(interval < debounce_us_)
+		{
+			++rejected_;
+			return false;
+		}
+		interval_us_ = interval;
+	}
+
+	have_pulse_ = true;
+	last_us_ = timestamp_us;
+	++pulses_;
+	return true;
+}
+
+std::optional<Fixed> PulseEstimator::power(uint32_t now_us) const
+{
+	if(!interval_us_) return std::nullopt;
+
+	uint32_t interval = interval_us_;
+	uint32_t since_last = now_us - last_us_;
+	if(since_last > interval) interval = since_last;
+
+	/* One pulse is 1/imp kWh = 3.6e12/imp W*us, so P = 3.6e12 / (imp * interval[us]) W.
+	 * The corrected constant is imp * correction. */
+	Fixed per_pulse = fixed_scale(FIXED_ONE * 1000000, 3600000, imp_per_kwh_); /* W*us, fixed */
+	per_pulse = fixed_scale(per_pulse, FIXED_ONE, correction_);
+	return per_pulse / interval;
+}
+
+void PulseEstimator::calibrate(Fixed energy_kwh)
+{
+	if(calibration_energy_)
+	{
+		uint32_t counted = pulses_ - calibration_pulses_;
+		Fixed delta = energy_kwh - *calibration_energy_;
+		if(counted < MIN_CALIBRATION_PULSES) return; /* Keep the reference, wait for more pulses */
+
+		if(delta > 0)
+		{
+			/* Pulses that should have been counted for the delta at the nominal constant, vs counted */
+			Fixed expected = fixed_mul(delta, static_cast<Fixed>(imp_per_kwh_) * FIXED_ONE);
+			Fixed correction = fixed_scale(static_cast<Fixed>(counted) * FIXED_ONE, FIXED_ONE, expected);
+			if(correction > FIXED_ONE - MAX_CORRECTION_DEVIATION && correction < FIXED_ONE + MAX_CORRECTION_DEVIATION)
+				correction_ = correction;
+		}
+	}
+
+	calibration_energy_ = energy_kwh;
+	calibration_pulses_ = pulses_;
+}
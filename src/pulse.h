@@ -0,0 +1,49 @@
+#ifndef IEC62056_MQTT_PULSE_H
+#define IEC62056_MQTT_PULSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "fixed.h"
+
+/* Estimates instantaneous power from the timestamps of the meter's impulse LED.
+ * Doesn't depend on the hardware, timestamps are fed in by the caller (the ISR glue
+ * in main.cpp, or a synthetic pulse train). */
+class PulseEstimator
+{
+public:
+	/* imp_per_kwh: the meter constant, debounce_us: pulses closer to the previous one
+	 * than this are ignored */
+	PulseEstimator(uint32_t imp_per_kwh, uint32_t debounce_us)
+	    : imp_per_kwh_(imp_per_kwh), debounce_us_(debounce_us)
+	{}
+
+	/* Register a pulse. Returns false if it was rejected by the debounce filter. */
+	bool pulse(uint32_t timestamp_us);
+	/* Estimated power in W at the given time, nullopt until two pulses have been seen.
+	 * If no pulse came for longer than the last interval, the power must have dropped, so
+	 * the time since the last pulse is used as the interval instead. */
+	std::optional<Fixed> power(uint32_t now_us) const;
+
+	/* Compare the pulses counted since the last call with the change of the energy
+	 * register (in kWh) and correct the meter constant accordingly. The first call only
+	 * sets the reference. */
+	void calibrate(Fixed energy_kwh);
+	/* Correction factor applied to the meter constant, in millionths */
+	Fixed correction() const { return correction_; }
+	uint32_t pulses() const { return pulses_; }
+	uint32_t rejected() const { return rejected_; }
+
+private:
+	uint32_t imp_per_kwh_, debounce_us_;
+	uint32_t last_us_ = 0, interval_us_ = 0;
+	uint32_t pulses_ = 0, rejected_ = 0;
+	bool have_pulse_ = false;
+
+	std::optional<Fixed> calibration_energy_;
+	uint32_t calibration_pulses_ = 0;
+	Fixed correction_ = FIXED_ONE;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include <cstring>
+
+#include <Arduino.h>
+#ifdef ARDUINO_ARCH_ESP8266
+#include <esp8266_peri.h>
+#endif
+
+#include "rx_ring.h"
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR /* Only matters for interrupt handlers on the ESP8266 */
+#endif
+
+IRAM_ATTR void RxRing::push(uint8_t byte, uint8_t flags, uint32_t now_us)
+{
+	uint32_t head = head_;
+	if(head - tail_ > mask_)
+	{
+		++stats_.overruns;
+		return;
+	}
+
+	if(!gap_restarted_ && now_us - last_byte_us_ > max_gap_us_) max_gap_us_ = now_us - last_byte_us_;
+	gap_restarted_ = false;
+	last_byte_us_ = now_us;
+
+	data_[head & mask_] = byte;
+	flags_[head & mask_] = flags;
+	if(flags & PARITY_ERROR) ++stats_.parity_errors;
+	if(flags & FRAMING_ERROR) ++stats_.framing_errors;
+
+	if(byte == '\n')
+	{
+		uint32_t line_head = line_head_;
+		if(line_head - line_tail_ < LINE_SLOTS)
+		{
+			line_ends_[line_head & (LINE_SLOTS - 1)] = head + 1;
+			line_head_ = line_head + 1;
+		}
+		else
+		{
+			lines_lost_ = true;
+		}
+	}
+
+	head_ = head + 1; /* Publish the byte last */
+	if(head + 1 - tail_ > stats_.high_water) stats_.high_water = head + 1 - tail_;
+}
+
+int RxRing::read(uint8_t *flags)
+{
+	if(!available()) return -1;
+
+	uint32_t tail = tail_;
+	if(flags) *flags = flags_[tail & mask_];
+	int byte = data_[tail & mask_];
+	consume(1);
+	return byte;
+}
+
+bool RxRing::peek_line(size_t max_length, char *scratch, std::string_view &line, uint8_t &flags)
+{
+	uint32_t tail = tail_, head = head_;
+	size_t length = 0;
+	if(!lines_lost_)
+	{
+		if(line_head_ != line_tail_) length = line_ends_[line_tail_ & (LINE_SLOTS - 1)] - tail;
+	}
+	else
+	{
+		/* More lines arrived than could be recorded, look for the end of this one */
+		for(uint32_t i = tail; i != head && i - tail < max_length; ++i)
+		{
+			if(data_[i & mask_] == '\n')
+			{
+				length = i + 1 - tail;
+				break;
+			}
+		}
+	}
+	if(!length || length > max_length)
+	{
+		if(head - tail < max_length) return false;
+		length = max_length;
+	}
+
+	size_t start = tail & mask_;
+	flags = 0;
+	for(size_t i = 0; i < length; ++i)
+		flags |= flags_[(tail + i) & mask_];
+
+	if(start + length <= mask_ + 1)
+	{
+		line = std::string_view(reinterpret_cast<char const *>(&data_[start]), length);
+	}
+	else
+	{
+		size_t first = mask_ + 1 - start;
+		memcpy(scratch, &data_[start], first);
+		memcpy(&scratch[first], data_, length - first);
+		line = std::string_view(scratch, length);
+	}
+	return true;
+}
+
+void RxRing::consume(size_t length)
+{
+	uint32_t tail = tail_ + length;
+	/* Forget the line ends that were passed */
+	while(line_tail_ != line_head_ && static_cast<int32_t>(line_ends_[line_tail_ & (LINE_SLOTS - 1)] - tail) <= 0)
+		++line_tail_;
+	if(lines_lost_ && line_tail_ == line_head_ && tail == head_) lines_lost_ = false;
+	tail_ = tail;
+}
+
+void RxRing::clear()
+{
+	consume(available());
+}
+
+uint32_t RxRing::take_max_gap_us(bool restart)
+{
+	uint32_t gap = max_gap_us_;
+	max_gap_us_ = 0;
+	if(restart) gap_restarted_ = !available(); /* The wait for the next byte isn't a gap */
+	return gap;
+}
+
+#ifdef ARDUINO_ARCH_ESP8266
+static RxRing *attached[2];
+
+/* Shared by both UARTs. The FIFO threshold is a single byte, so the error flags raised
+ * with an interrupt belong to the byte that triggered it, the last one in the FIFO. */
+static IRAM_ATTR void uart_isr(void *, void *)
+{
+	for(int nr = 0; nr < 2; ++nr)
+	{
+		RxRing *ring = attached[nr];
+		if(!ring) continue;
+
+		uint32_t status = USIS(nr);
+		if(!status) continue;
+
+		uint8_t flags = 0;
+		if(status & (1 << UIPE)) flags |= RxRing::PARITY_ERROR;
+		if(status & (1 << UIFR)) flags |= RxRing::FRAMING_ERROR;
+		if(status & (1 << UIOF)) ring->fifo_overrun();
+
+		uint32_t now_us = micros();
+		for(uint32_t count = (USS(nr) >> USRXC) & 0xff; count > 0; --count)
+			ring->push(USF(nr), count == 1 ? flags : 0, now_us);
+		USIC(nr) = status;
+	}
+}
+
+void RxRing::attach(int uart_nr)
+{
+	ETS_UART_INTR_DISABLE();
+	attached[uart_nr] = this;
+	ETS_UART_INTR_ATTACH(uart_isr, nullptr);
+	USC1(uart_nr) = (1 << UCFFT) | (2 << UCTOT) | (1 << UCTOE); /* Full threshold 1 byte, timeout 2 bytes */
+	USIC(uart_nr) = 0xffff;
+	USIE(uart_nr) = (1 << UIFF) | (1 << UITO) | (1 << UIOF) | (1 << UIPE) | (1 << UIFR);
+	ETS_UART_INTR_ENABLE();
+}
+#endif
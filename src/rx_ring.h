@@ -0,0 +1,79 @@
+#ifndef IEC62056_MQTT_RX_RING_H
+#define IEC62056_MQTT_RX_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/* Receive buffer for the meter's UART, filled straight from the UART interrupt instead of
+ * by the serial driver, so that bytes aren't lost while the main loop is busy. Every byte
+ * is stored with its parity/framing error flags, and the interrupt records where lines end
+ * so that the reader can take whole lines without scanning for them or copying them.
+ *
+ * There is a single producer (the interrupt) and a single consumer (the reader). The
+ * buffers are provided by the caller; their size must be a power of two. */
+class RxRing
+{
+public:
+	/* Byte flags */
+	static uint8_t const PARITY_ERROR = 1 << 0;
+	static uint8_t const FRAMING_ERROR = 1 << 1;
+
+	struct Stats
+	{
+		uint32_t overruns;      /* Bytes dropped because the ring was full */
+		uint32_t fifo_overruns; /* The UART's FIFO overflowed before the interrupt emptied it */
+		uint32_t parity_errors, framing_errors;
+		uint32_t high_water;    /* Most bytes ever waiting in the ring */
+	};
+
+	RxRing(uint8_t *data, uint8_t *flags, size_t size) : data_(data), flags_(flags), mask_(size - 1) {}
+
+	/* Producer side, called from the interrupt */
+	void push(uint8_t byte, uint8_t flags, uint32_t now_us);
+	void fifo_overrun() { ++stats_.fifo_overruns; }
+
+	/* Consumer side */
+	size_t available() const { return head_ - tail_; }
+	/* Next byte, -1 if there is none */
+	int read(uint8_t *flags = nullptr);
+	/* The next line, up to and including '\n', or max_length bytes if the line is longer.
+	 * Returns false until either has arrived. The line stays in the ring until it's
+	 * consumed; only if it wraps around the end of the ring is it copied into scratch
+	 * (max_length bytes). flags are those of all of the line's bytes combined. */
+	bool peek_line(size_t max_length, char *scratch, std::string_view &line, uint8_t &flags);
+	void consume(size_t length);
+	void clear();
+
+	/* micros() when the last byte arrived */
+	uint32_t last_byte_us() const { return last_byte_us_; }
+	/* Longest gap between two bytes since the last call. With restart, if no bytes are
+	 * waiting, the time until the next one arrives doesn't count. */
+	uint32_t take_max_gap_us(bool restart = true);
+	Stats const &stats() const { return stats_; }
+
+#ifdef ARDUINO_ARCH_ESP8266
+	/* Take over the receive interrupt of a UART. HardwareSerial::begin() attaches the
+	 * driver's own, so this needs to be called again after it. */
+	void attach(int uart_nr);
+#endif
+
+private:
+	static size_t const LINE_SLOTS = 16; /* Must be a power of two */
+
+	uint8_t *data_, *flags_;
+	size_t mask_;
+	/* Free-running byte counters: written by the producer, read by the consumer */
+	uint32_t volatile head_ = 0;
+	uint32_t volatile tail_ = 0;
+	/* Positions just after every '\n' that hasn't been consumed, as long as they fit */
+	uint32_t line_ends_[LINE_SLOTS];
+	uint32_t volatile line_head_ = 0;
+	uint32_t line_tail_ = 0;
+	bool volatile lines_lost_ = false; /* Line ends that didn't fit, have to be searched for */
+	uint32_t volatile last_byte_us_ = 0, max_gap_us_ = 0;
+	bool volatile gap_restarted_ = true;
+	Stats stats_ = {};
+};
+
+#endif
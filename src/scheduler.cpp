@@ -0,0 +1,192 @@
+#include <Arduino.h>
+
+#include "scheduler.h"
+
+namespace scheduler
+{
+size_t const WHEEL_SLOTS = 64;     /* Must be a power of 2 */
+size_t const MAX_READY_TASKS = 16; /* Tasks run in a single pass */
+
+static Task *wheel[WHEEL_SLOTS];
+static uint32_t current_tick; /* All slots up to this tick have been expired */
+static Task *registered;
+
+static bool (*wake_condition)();
+static Task *wake_task;
+static void (*run_hook)(Task const &task, uint32_t cycles);
+
+/* Deadlines are compared with wraparound, like millis() should always be */
+static bool is_due(uint32_t deadline, uint32_t now)
+{
+	return static_cast<int32_t>(now - deadline) >= 0;
+}
+
+static void unlink(Task &task)
+{
+	Task **link = &wheel[task.deadline_ms % WHEEL_SLOTS];
+	while(*link && *link != &task)
+	{
+		link = &(*link)->next_in_slot;
+	}
+	if(*link) *link = task.next_in_slot;
+
+	task.next_in_slot = nullptr;
+	task.scheduled = false;
+}
+
+static void schedule_at(Task &task, uint32_t deadline)
+{
+	if(task.scheduled) unlink(task);
+	task.ready = false;
+
+	if(is_due(deadline, current_tick))
+	{
+		/* That tick's slot was already expired, so it would only be noticed one rotation later */
+		task.ready = true;
+		return;
+	}
+
+	task.deadline_ms = deadline;
+	task.scheduled = true;
+	Task *&slot = wheel[deadline % WHEEL_SLOTS];
+	task.next_in_slot = slot;
+	slot = &task;
+}
+
+/* Move the tasks of all elapsed ticks that are due to the ready state */
+static void expire(uint32_t now)
+{
+	uint32_t ticks = now - current_tick;
+	if(ticks > WHEEL_SLOTS) ticks = WHEEL_SLOTS; /* Every slot is looked at once anyway */
+
+	for(uint32_t i = 1; i <= ticks; ++i)
+	{
+		Task **link = &wheel[(current_tick + i) % WHEEL_SLOTS];
+		while(*link)
+		{
+			Task *task = *link;
+			if(is_due(task->deadline_ms, now))
+			{
+				*link = task->next_in_slot;
+				task->next_in_slot = nullptr;
+				task->scheduled = false;
+				task->ready = true;
+			}
+			else
+			{
+				link = &task->next_in_slot; /* Due in a later rotation */
+			}
+		}
+	}
+
+	current_tick = now;
+}
+
+static void make_ready(Task &task)
+{
+	if(task.scheduled) unlink(task);
+	task.ready = true;
+}
+
+void add(Task &task)
+{
+	if(!registered) current_tick = millis();
+
+	task.next_registered = registered;
+	registered = &task;
+
+	if(task.period_ms) schedule_in(task, task.period_ms);
+}
+
+void schedule_in(Task &task, uint32_t delay_ms)
+{
+	expire(millis());
+	schedule_at(task, current_tick + delay_ms);
+}
+
+void cancel(Task &task)
+{
+	if(task.scheduled) unlink(task);
+	task.ready = false;
+}
+
+void on_task_run(void (*hook)(Task const &task, uint32_t cycles))
+{
+	run_hook = hook;
+}
+
+void wake_on(bool (*condition)(), Task &task)
+{
+	wake_condition = condition;
+	wake_task = &task;
+}
+
+static void run(Task &task)
+{
+	task.ready = false;
+	if(task.period_ms) schedule_at(task, current_tick + task.period_ms);
+
+	uint32_t start = micros();
+	uint32_t start_cycles = ESP.getCycleCount();
+	task.function();
+	uint32_t cycles = ESP.getCycleCount() - start_cycles;
+	uint32_t elapsed = micros() - start;
+
+	++task.runs;
+	task.total_us += elapsed;
+	if(elapsed > task.max_us) task.max_us = elapsed;
+	if(run_hook) run_hook(task, cycles);
+}
+
+void run_due()
+{
+	expire(millis());
+
+	/* Take a snapshot of the ready tasks, sorted by priority */
+	Task *ready[MAX_READY_TASKS];
+	size_t count = 0;
+	for(Task *task = registered; task && count < MAX_READY_TASKS; task = task->next_registered)
+	{
+		if(!task->ready) continue;
+
+		size_t i = count++;
+		for(; i > 0 && ready[i - 1]->priority < task->priority; --i)
+		{
+			ready[i] = ready[i - 1];
+		}
+		ready[i] = task;
+	}
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		/* A task that ran before might have rescheduled or cancelled this one */
+		if(ready[i]->ready) run(*ready[i]);
+	}
+}
+
+void sleep(uint32_t max_ms)
+{
+	uint32_t now = millis();
+	uint32_t until = now + max_ms;
+	for(Task *task = registered; task; task = task->next_registered)
+	{
+		if(task->ready) return; /* Something to do already */
+		if(task->scheduled && static_cast<int32_t>(until - task->deadline_ms) > 0) until = task->deadline_ms;
+	}
+
+	while(!is_due(until, millis()))
+	{
+		if(wake_condition && wake_condition())
+		{
+			make_ready(*wake_task);
+			return;
+		}
+		delay(1);
+	}
+}
+
+Task const *tasks()
+{
+	return registered;
+}
+}
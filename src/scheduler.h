@@ -0,0 +1,54 @@
+#ifndef IEC62056_MQTT_SCHEDULER_H
+#define IEC62056_MQTT_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* A task run by the cooperative scheduler. Tasks are statically allocated and must
+ * not block for long. */
+struct Task
+{
+	char const *name;
+	void (*function)();
+	uint8_t priority;   /* Of tasks due at the same time, higher priority ones run first */
+	uint32_t period_ms; /* Periodic tasks are rescheduled automatically, 0 for one-shot */
+
+	/* Run time accounting */
+	uint32_t runs = 0;
+	uint32_t total_us = 0;
+	uint32_t max_us = 0;
+
+	/* Scheduler state */
+	uint32_t deadline_ms = 0;
+	bool scheduled = false, ready = false;
+	Task *next_in_slot = nullptr, *next_registered = nullptr;
+};
+
+/* Runs tasks at their deadlines. Timers are kept in a hashed timer wheel with 1 ms ticks,
+ * so that only the slots of the ticks that elapsed need to be looked at. */
+namespace scheduler
+{
+/* Make the scheduler aware of a task. Periodic tasks are scheduled right away. */
+void add(Task &task);
+/* (Re)schedule the task to run after the given delay (0 = on the next pass) */
+void schedule_in(Task &task, uint32_t delay_ms);
+void cancel(Task &task);
+
+/* While sleeping, check the condition and make the task ready as soon as it's true
+ * (for example to wake up when serial data arrives) */
+void wake_on(bool (*condition)(), Task &task);
+
+/* Run all tasks that are due, in order of priority. Tasks that become due while this
+ * happens are run in the next pass. */
+void run_due();
+/* Sleep until the next deadline or the wake condition, at most max_ms */
+void sleep(uint32_t max_ms);
+
+/* Call hook after every task run with the number of CPU cycles the run took */
+void on_task_run(void (*hook)(Task const &task, uint32_t cycles));
+
+/* All added tasks, follow next_registered */
+Task const *tasks();
+}
+
+#endif
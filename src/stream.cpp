@@ -0,0 +1,188 @@
+#include "config.h"
+
+#ifdef STREAM_PORT
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "logger.h"
+#include "meter.h"
+#include "stream.h"
+
+namespace stream
+{
+/* Room for a subscription to STREAM_MAX_OBJECTS objects */
+size_t const MAX_REQUEST_LENGTH = STREAM_MAX_OBJECTS * (MAX_OBIS_CODE_LENGTH + 1) + 1;
+
+struct Client
+{
+	WiFiClient socket;
+	bool active;
+	char request[MAX_REQUEST_LENGTH];
+	size_t request_length;
+	char objects[STREAM_MAX_OBJECTS][MAX_OBIS_CODE_LENGTH + 1];
+	size_t object_count; /* 0 until subscribed */
+	uint8_t queue[STREAM_CLIENT_BUFFER];
+	size_t queued;
+};
+
+static WiFiServer server(STREAM_PORT);
+static Client clients[STREAM_MAX_CLIENTS];
+static Stats stats_;
+
+static void disconnect(Client &client)
+{
+	client.socket.stop();
+	client.active = false;
+	--stats_.clients;
+}
+
+/* Write out as much of the queue as the TCP stack takes without waiting */
+static void flush(Client &client)
+{
+	size_t room = client.socket.availableForWrite();
+	if(!client.queued || !room) return;
+
+	size_t written = client.socket.write(client.queue, room < client.queued ? room : client.queued);
+	client.queued -= written;
+	memmove(client.queue, &client.queue[written], client.queued);
+}
+
+/* Queue data for a client, disconnecting it if it doesn't fit */
+static bool enqueue(Client &client, char const *data, size_t length)
+{
+	if(client.queued + length > sizeof(client.queue))
+	{
+		logger::warn("stream client too slow, disconnecting");
+		++stats_.dropped;
+		disconnect(client);
+		return false;
+	}
+
+	memcpy(&client.queue[client.queued], data, length);
+	client.queued += length;
+	return true;
+}
+
+static void subscribe(Client &client)
+{
+	client.object_count = 0;
+	char *save;
+	for(char *obis = strtok_r(client.request, " \r", &save); obis && client.object_count < STREAM_MAX_OBJECTS;
+	    obis = strtok_r(nullptr, " \r", &save))
+	{
+		strlcpy(client.objects[client.object_count++], obis, MAX_OBIS_CODE_LENGTH + 1);
+	}
+
+	char reply[MAX_REQUEST_LENGTH + 2] = "#";
+	for(size_t i = 0; i < client.object_count; ++i)
+	{
+		strlcat(reply, " ", sizeof(reply));
+		strlcat(reply, client.objects[i], sizeof(reply));
+	}
+	strlcat(reply, "\n", sizeof(reply));
+	if(enqueue(client, reply, strlen(reply))) flush(client);
+}
+
+static void read_request(Client &client)
+{
+	while(client.active && client.socket.available())
+	{
+		int c = client.socket.read();
+		if(c < 0) break;
+
+		if(c == '\n')
+		{
+			client.request[client.request_length] = 0;
+			client.request_length = 0;
+			subscribe(client);
+		}
+		else if(client.request_length < sizeof(client.request) - 1)
+		{
+			client.request[client.request_length++] = c;
+		}
+	}
+}
+
+static void accept()
+{
+	WiFiClient socket = server.available();
+	if(!socket) return;
+
+	for(Client &client : clients)
+	{
+		if(client.active) continue;
+
+		client.socket = socket;
+		client.socket.setNoDelay(true);
+		client.active = true;
+		client.request_length = client.object_count = client.queued = 0;
+		++stats_.clients;
+		return;
+	}
+
+	socket.stop();
+	++stats_.rejected;
+}
+
+void begin()
+{
+	server.begin();
+	server.setNoDelay(true);
+}
+
+void poll()
+{
+	accept();
+	for(Client &client : clients)
+	{
+		if(!client.active) continue;
+		if(!client.socket.connected())
+		{
+			disconnect(client);
+			continue;
+		}
+
+		read_request(client);
+		if(client.active) flush(client);
+	}
+}
+
+void send(uint32_t sequence, char const *(*value)(char const *obis))
+{
+	for(Client &client : clients)
+	{
+		if(!client.active || !client.object_count) continue;
+
+		/* A value can take up almost a whole data line */
+		static char frame[16 + STREAM_MAX_OBJECTS * (MAX_LINE_LENGTH + 1) + 1];
+		size_t length = snprintf(frame, sizeof(frame), "%" PRIu32, sequence);
+		for(size_t i = 0; i < client.object_count && length < sizeof(frame); ++i)
+		{
+			char const *text = value(client.objects[i]);
+			length += snprintf(&frame[length], sizeof(frame) - length, " %s", text && *text ? text : "-");
+		}
+		if(length < sizeof(frame)) length += snprintf(&frame[length], sizeof(frame) - length, "\n");
+		if(length >= sizeof(frame))
+		{
+			logger::warn("stream frame too long, not sent");
+			continue;
+		}
+
+		if(!enqueue(client, frame, length)) continue;
+		++stats_.frames;
+		flush(client);
+	}
+}
+
+Stats const &stats()
+{
+	return stats_;
+}
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef IEC62056_MQTT_STREAM_H
+#define IEC62056_MQTT_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* A TCP endpoint on STREAM_PORT that pushes readouts to local clients as soon as their
+ * checksum has been verified, without going through the MQTT broker.
+ *
+ * Protocol (text, lines end with '\n'): the client sends the OBIS codes it's interested
+ * in, separated by spaces, on one line. The device confirms with "# " and the same codes,
+ * then sends a line "sequence value value ..." after every readout, with the values in
+ * the order of the subscription ("-" for objects without a value). Sending another line
+ * replaces the subscription. Frames are queued in a fixed-size buffer per client; clients
+ * that don't keep up are disconnected rather than delaying readouts. */
+namespace stream
+{
+struct Stats
+{
+	uint32_t clients;  /* Connected */
+	uint32_t frames;   /* Queued to clients */
+	uint32_t dropped;  /* Clients disconnected because their buffer overflowed */
+	uint32_t rejected; /* Connections refused because all slots were taken */
+};
+
+void begin();
+/* Accept clients, read their subscriptions and send what's queued. Doesn't block. */
+void poll();
+/* Send a readout to all subscribed clients. value returns the value of an object, nullptr
+ * if there is none. */
+void send(uint32_t sequence, char const *(*value)(char const *obis));
+
+Stats const &stats();
+}
+
+#endif
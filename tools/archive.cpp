@@ -0,0 +1,126 @@
+#include <cctype>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "archive.h"
+#include "lexer.h"
+#include "meter.h"
+
+namespace archive
+{
+/* Frames are found by the bytes that can only appear at their boundaries: the '/' starting
+ * the identification message and the ETX after the data block. Everything else is skipped
+ * 16 bytes at a time. */
+static bool is_candidate(char c)
+{
+	return c == '/' || c == lexer::ETX;
+}
+
+/* Position of the next '/' or ETX at or after pos, or end */
+static size_t next_candidate(char const *data, size_t pos, size_t end)
+{
+#if defined(__SSE2__)
+	__m128i const slash = _mm_set1_epi8('/'), etx = _mm_set1_epi8(lexer::ETX);
+	for(; pos + 16 <= end; pos += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(&data[pos]));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, slash), _mm_cmpeq_epi8(block, etx)));
+		if(mask) return pos + __builtin_ctz(mask);
+	}
+#endif
+	for(; pos < end; ++pos)
+	{
+		if(is_candidate(data[pos])) return pos;
+	}
+	return end;
+}
+
+/* Whether the '/' at pos is followed by what an identification message starts with: the
+ * manufacturer's three letters and the baud rate character */
+static bool is_identification_header(char const *data, size_t size, size_t pos)
+{
+	if(pos + 5 > size) return false;
+	for(size_t i = pos + 1; i < pos + 4; ++i)
+	{
+		if(!isalpha(static_cast<unsigned char>(data[i]))) return false;
+	}
+	char baud = data[pos + 4];
+	return (baud >= '0' && baud <= '9') || (baud >= 'A' && baud <= 'I');
+}
+
+/* Whether a '/' at pos starts an identification message: at the start of a line, right
+ * after the previous frame's ETX and BCC, or anywhere if it looks like one (after a frame
+ * that was cut off mid-line). Only depends on the bytes around it, so that every thread
+ * comes to the same conclusion. */
+static bool starts_frame(char const *data, size_t size, size_t pos)
+{
+	return pos == 0 || data[pos - 1] == '\n' || (pos >= 2 && data[pos - 2] == lexer::ETX) ||
+	       is_identification_header(data, size, pos);
+}
+
+void find_frames(char const *data, size_t size, size_t begin, size_t end, std::vector<Frame> &frames)
+{
+	static char const END[] = {'!', '\r', '\n'};
+
+	size_t start = SIZE_MAX; /* Of the current frame */
+	for(size_t pos = next_candidate(data, begin, size); pos < size; pos = next_candidate(data, pos + 1, size))
+	{
+		if(data[pos] == '/')
+		{
+			if(!starts_frame(data, size, pos)) continue;
+			if(pos >= end) break; /* Belongs to the next range */
+			start = pos;          /* A new identification message also drops an incomplete frame */
+		}
+		else if(start != SIZE_MAX && pos + 1 < size && pos - start >= sizeof(END) &&
+		        !memcmp(&data[pos - sizeof(END)], END, sizeof(END)))
+		{
+			frames.push_back({start, pos + 2 - start}); /* Including the BCC */
+			start = SIZE_MAX;
+			++pos; /* The BCC can be anything */
+		}
+		else if(start == SIZE_MAX && pos >= end)
+		{
+			break;
+		}
+	}
+}
+
+Status parse_frame(std::string_view frame, std::vector<Object> &objects)
+{
+	objects.clear();
+
+	/* Identification, as in MeterReader::read_identification() */
+	std::string_view identification = frame.substr(0, MAX_IDENTIFICATION_LENGTH + 1);
+	size_t pos = identification.find('\n');
+	pos = pos == std::string_view::npos ? identification.size() : pos + 1;
+	size_t len = identification[pos - 1] == '\n' ? pos - 1 : pos;
+	if(len < 6) return Status::ProtocolError;
+
+	/* Data lines, as in MeterReader::read_line(): at most MAX_LINE_LENGTH + 1 bytes at a time */
+	uint8_t checksum = lexer::STX; /* The STX is part of the first line but not the checksum */
+	for(;;)
+	{
+		std::string_view rest = frame.substr(pos, MAX_LINE_LENGTH + 1);
+		size_t newline = rest.find('\n');
+		std::string_view line = newline == std::string_view::npos ? rest : rest.substr(0, newline + 1);
+		bool truncated = line.size() == MAX_LINE_LENGTH + 1 && line.back() != '\n';
+		if(!truncated && line.size() < 3) return Status::ProtocolError; /* Also the end of the frame */
+		pos += line.size();
+
+		lexer::Line scanned = lexer::scan_line(line);
+		checksum ^= scanned.checksum;
+		if(scanned.kind == lexer::Line::Kind::End) break;
+		if(scanned.kind == lexer::Line::Kind::Data && scanned.value_valid)
+			objects.push_back({scanned.obis, scanned.value});
+	}
+
+	/* ETX and BCC, as in MeterReader::verify_checksum() */
+	if(pos + 2 > frame.size() || frame[pos] != lexer::ETX) return Status::ProtocolError;
+	checksum ^= lexer::ETX;
+
+	return checksum == static_cast<uint8_t>(frame[pos + 1]) ? Status::Ok : Status::ChecksumError;
+}
+}
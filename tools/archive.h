@@ -0,0 +1,41 @@
+/* Parsing of archived readouts: files of concatenated raw data readouts as received from
+ * meters ("/ident\r\n", STX, data lines, "!\r\n", ETX, BCC), with the same semantics as
+ * MeterReader (see src/meter.cpp) and the same configuration (host/config.h). */
+
+#ifndef IEC62056_MQTT_TOOLS_ARCHIVE_H
+#define IEC62056_MQTT_TOOLS_ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace archive
+{
+struct Frame
+{
+	size_t offset, length;
+};
+
+/* Find the frames that start in data[begin, end). The last of them may extend beyond end
+ * (but not beyond size). Data that isn't part of a complete frame is skipped. */
+void find_frames(char const *data, size_t size, size_t begin, size_t end, std::vector<Frame> &frames);
+
+enum class Status : uint8_t
+{
+	Ok,
+	ProtocolError,
+	ChecksumError,
+};
+
+struct Object
+{
+	std::string_view obis, value; /* Point into the frame */
+};
+
+/* Parse and validate a frame. Objects with invalid values are skipped, like the reader
+ * does. Objects are only valid if the status is Ok. */
+Status parse_frame(std::string_view frame, std::vector<Object> &objects);
+}
+
+#endif
@@ -0,0 +1,136 @@
+/* Compares the per-line cost of the table-driven scanner (src/lexer.cpp) with the
+ * original strchr()-based line handling of MeterReader::read_line().
+ *
+ * Usage: bench_lexer [iterations]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "config.h"
+#include "lexer.h"
+
+/* The line handling as it was before the lexer */
+namespace baseline
+{
+static bool is_valid_object_value(std::string_view value)
+{
+	for(size_t i = 0; i < value.size(); ++i)
+	{
+		if(!strchr(OBJECT_VALUE_ALLOWED_CHARS, value[i]))
+			return false;
+	}
+
+	return true;
+}
+
+static void postprocess_value(std::string_view &value)
+{
+#ifdef STRIP_UNIT
+	size_t unit_sep_pos = value.find_last_of('*');
+	if(unit_sep_pos != std::string_view::npos)
+		value.remove_suffix(value.size() - unit_sep_pos);
+#else
+	(void)value;
+#endif
+}
+
+static size_t handle_line(char const *line, size_t len, uint8_t &checksum)
+{
+	for(size_t i = 0; i < len; ++i)
+	{
+		checksum ^= line[i];
+	}
+
+	if(line[len - 3] == '!') return 0;
+
+	std::string_view line_view(line, len - 2);
+	if(line_view[0] == lexer::STX) line_view.remove_prefix(1);
+
+	auto lparen = line_view.find_first_of('(');
+	auto rparen = line_view.find_last_of(')');
+	if(lparen == std::string_view::npos || rparen == std::string_view::npos) return 0;
+
+	auto value = line_view.substr(lparen + 1, rparen - (lparen + 1));
+	postprocess_value(value);
+	return is_valid_object_value(value);
+}
+}
+
+static std::vector<std::string> make_lines()
+{
+	static char const *const TEMPLATES[] = {
+	    "\x02" "F.F(00000000)\r\n",
+	    "0.0.0(12345678)\r\n",
+	    "0.9.1(142307)\r\n",
+	    "0.9.2(1231019)\r\n",
+	    "15.7.0(00.8342*kW)\r\n",
+	    "15.8.0(00012345.67*kWh)\r\n",
+	    "15.8.1(00009876.54*kWh)\r\n",
+	    "15.8.2(00002469.13*kWh)\r\n",
+	    "32.7.0(232.1*V)\r\n",
+	    "52.7.0(231.7*V)\r\n",
+	    "72.7.0(233.0*V)\r\n",
+	    "31.7.0(001.23*A)\r\n",
+	    "51.7.0(000.87*A)\r\n",
+	    "71.7.0(002.41*A)\r\n",
+	    "C.1.0(17654321)\r\n",
+	    "!\r\n",
+	};
+	return std::vector<std::string>(std::begin(TEMPLATES), std::end(TEMPLATES));
+}
+
+template<typename F> static void measure(char const *name, std::vector<std::string> const &lines, long iterations, F &&f)
+{
+	size_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_RDTSC
+	uint64_t cycles_start = __rdtsc();
+#endif
+	for(long i = 0; i < iterations; ++i)
+	{
+		for(auto const &line : lines)
+		{
+			sink += f(line);
+		}
+	}
+#ifdef HAVE_RDTSC
+	double cycles = static_cast<double>(__rdtsc() - cycles_start);
+#endif
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	double count = static_cast<double>(iterations) * lines.size();
+	printf("%-10s %8.1f ns/line", name, ns / count);
+#ifdef HAVE_RDTSC
+	printf(" %8.1f cycles/line", cycles / count);
+#endif
+	printf("  (%zu)\n", sink);
+}
+
+int main(int argc, char **argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+	auto lines = make_lines();
+
+	measure("strchr", lines, iterations, [](std::string const &line) {
+		uint8_t checksum = 0;
+		size_t valid = baseline::handle_line(line.data(), line.size(), checksum);
+		return valid + checksum;
+	});
+	measure("table", lines, iterations, [](std::string const &line) {
+		lexer::Line scanned = lexer::scan_line(line);
+		return static_cast<size_t>(scanned.value_valid) + scanned.checksum;
+	});
+
+	return 0;
+}
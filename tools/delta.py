@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""Reference decoder for the delta frames published with DELTA_OBJECTS (see src/delta.h),
+and a comparison of their size with publishing the same values as text.
+
+Decoding reads frames as hex, one per line, as printed by `mosquitto_sub -F %x`. The
+object codes aren't part of the frames, so they have to be given in the configured order:
+
+    mosquitto_sub -h broker -t elec/delta -F %x | tools/delta.py decode 15.8.1 15.8.2
+
+When a frame is missing, the values are unknown until the next keyframe. Send "resync"
+to the command topic to get one straight away.
+
+The comparison reads the values of recorded readouts as printed by `mosquitto_sub -v`
+(for example a day of them) and prints the number of bytes sent to the broker both ways,
+MQTT headers included:
+
+    mosquitto_sub -h broker -v -t 'elec/obis/#' > day.txt
+    tools/delta.py compare -k 60 day.txt 15.8.1 15.8.2
+"""
+
+import argparse
+import sys
+
+KEYFRAME = 0
+DELTA = 1
+
+
+def put_varint(out, value):
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def put_zigzag(out, value):
+    put_varint(out, (value << 1) if value >= 0 else ((-value) << 1) - 1)
+
+
+def get_varint(frame, pos):
+    value = shift = 0
+    while True:
+        if pos >= len(frame):
+            raise ValueError("truncated varint")
+        byte = frame[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def get_zigzag(frame, pos):
+    value, pos = get_varint(frame, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def parse_value(text):
+    """Split a value such as "-0012.345*kW" into its number of decimals and the value as
+    an integer in units of the last decimal, like the device does. ',' is a decimal
+    separator too."""
+    number = text.split("*", 1)[0].replace(",", ".")
+    decimals = min(len(number) - number.index(".") - 1, 6) if "." in number else 0
+    whole, _, fraction = number.partition(".")
+    return decimals, int(whole + fraction[:decimals])
+
+
+def format_value(decimals, value):
+    sign = "-" if value < 0 else ""
+    digits = str(abs(value)).rjust(decimals + 1, "0")
+    return sign + (digits[:-decimals] + "." + digits[-decimals:] if decimals else digits)
+
+
+class Encoder:
+    """Same as the device's encoder"""
+
+    def __init__(self, count, keyframe_interval):
+        self.count = count
+        self.keyframe_interval = keyframe_interval
+        self.sequence = 0
+        self.since_keyframe = 0
+        self.previous = None
+
+    def encode(self, values):
+        current = [parse_value(value) for value in values]
+        keyframe = (self.previous is None or self.since_keyframe + 1 >= self.keyframe_interval
+                    or [d for d, _ in current] != [d for d, _ in self.previous])
+
+        frame = bytearray([KEYFRAME if keyframe else DELTA])
+        put_varint(frame, self.sequence)
+        for i, (decimals, value) in enumerate(current):
+            if keyframe:
+                frame.append(decimals)
+                put_zigzag(frame, value)
+            else:
+                put_zigzag(frame, value - self.previous[i][1])
+
+        self.sequence = (self.sequence + 1) & 0xFFFFFFFF
+        self.since_keyframe = 0 if keyframe else self.since_keyframe + 1
+        self.previous = current
+        return bytes(frame)
+
+
+class Decoder:
+    def __init__(self, count):
+        self.count = count
+        self.sequence = None
+        self.values = None  # [(decimals, value)], None until a keyframe arrives
+
+    def decode(self, frame):
+        """Returns the decoded values as text, or None if they are unknown because of
+        a missing frame"""
+        if not frame or frame[0] not in (KEYFRAME, DELTA):
+            raise ValueError("unknown frame type")
+        sequence, pos = get_varint(frame, 1)
+        if self.sequence is not None and sequence != (self.sequence + 1) & 0xFFFFFFFF:
+            self.values = None  # Missed a frame (or the device restarted)
+        self.sequence = sequence
+
+        if frame[0] == KEYFRAME:
+            values = []
+            for _ in range(self.count):
+                if pos >= len(frame):
+                    raise ValueError("truncated frame")
+                decimals = frame[pos]
+                value, pos = get_zigzag(frame, pos + 1)
+                values.append((decimals, value))
+            self.values = values
+        else:
+            deltas = []
+            for _ in range(self.count):
+                delta, pos = get_zigzag(frame, pos)
+                deltas.append(delta)
+            if self.values is not None:
+                self.values = [(d, v + delta) for (d, v), delta in zip(self.values, deltas)]
+
+        if pos != len(frame):
+            raise ValueError(f"{len(frame) - pos} bytes left over, wrong number of objects?")
+        return None if self.values is None else [format_value(d, v) for d, v in self.values]
+
+
+def publish_size(topic, payload_length):
+    """Size of an MQTT PUBLISH packet with QoS 0"""
+    remaining = 2 + len(topic) + payload_length
+    length_bytes = 1
+    while remaining >= 128 ** length_bytes:
+        length_bytes += 1
+    return 1 + length_bytes + remaining
+
+
+def decode(args):
+    decoder = Decoder(len(args.objects))
+    for line in sys.stdin:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            values = decoder.decode(bytes.fromhex(line))
+        except ValueError as e:
+            sys.stderr.write(f"ignoring malformed frame ({e}): {line}\n")
+            continue
+        if values is None:
+            sys.stderr.write(f"{decoder.sequence}: missed a frame, waiting for a keyframe\n")
+            continue
+        print(decoder.sequence, " ".join(f"{o}={v}" for o, v in zip(args.objects, values)))
+
+
+def read_readouts(lines, objects):
+    """Group `topic payload` lines into readouts: a readout ends when an object repeats"""
+    current = {}
+    for line in lines:
+        topic, _, payload = line.strip().partition(" ")
+        obis = topic.rsplit("/", 1)[-1]
+        if obis not in objects:
+            continue
+        if obis in current:
+            yield topic.rsplit("/", 1)[0], current
+            current = {}
+        current[obis] = payload
+    if current:
+        yield topic.rsplit("/", 1)[0], current
+
+
+def compare(args):
+    encoder = Encoder(len(args.objects), args.keyframe_interval)
+    decoder = Decoder(len(args.objects))
+    readouts = text_bytes = delta_bytes = frame_bytes = keyframes = skipped = 0
+    with open(args.recording) as f:
+        for prefix, values in read_readouts(f, set(args.objects)):
+            if len(values) != len(args.objects):
+                skipped += 1  # The device doesn't send a frame in this case either
+                continue
+            readouts += 1
+            text_bytes += sum(publish_size(f"{prefix}/{o}", len(v.encode())) for o, v in values.items())
+
+            frame = encoder.encode([values[o] for o in args.objects])
+            keyframes += frame[0] == KEYFRAME
+            frame_bytes += len(frame)
+            delta_topic = prefix.rsplit("/", 1)[0] + "/delta"
+            delta_bytes += publish_size(delta_topic, len(frame))
+
+            decoded = decoder.decode(frame)  # Check the round trip while at it
+            expected = [format_value(*parse_value(values[o])) for o in args.objects]
+            if decoded != expected:
+                sys.exit(f"round trip failed: {decoded} != {expected}")
+
+    if not readouts:
+        sys.exit("no complete readouts found")
+    print(f"{readouts} readouts ({skipped} incomplete ones skipped), {keyframes} keyframes")
+    print(f"text:   {text_bytes:>10} bytes, {text_bytes / readouts:.1f} per readout")
+    print(f"delta:  {delta_bytes:>10} bytes, {delta_bytes / readouts:.1f} per readout "
+          f"({frame_bytes / readouts:.1f} of them frame)")
+    print(f"saving: {100 * (1 - delta_bytes / text_bytes):.1f}%")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    decode_parser = commands.add_parser("decode", help="decode hex frames from stdin")
+    decode_parser.add_argument("objects", nargs="+", help="DELTA_OBJECTS, in order")
+    decode_parser.set_defaults(function=decode)
+
+    compare_parser = commands.add_parser("compare", help="compare with text on recorded readouts")
+    compare_parser.add_argument("-k", "--keyframe-interval", type=int, default=60,
+                                help="DELTA_KEYFRAME_INTERVAL (default: 60)")
+    compare_parser.add_argument("recording", help="output of mosquitto_sub -v")
+    compare_parser.add_argument("objects", nargs="+", help="DELTA_OBJECTS, in order")
+    compare_parser.set_defaults(function=compare)
+
+    args = parser.parse_args()
+    args.function(args)
+
+
+if __name__ == "__main__":
+    main()
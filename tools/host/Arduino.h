@@ -0,0 +1,17 @@
+#ifndef IEC62056_MQTT_HOST_ARDUINO_H
+#define IEC62056_MQTT_HOST_ARDUINO_H
+
+/* Just enough of the Arduino core to build the reader on a PC. The functions are
+ * implemented by each tool. */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <HardwareSerial.h>
+
+uint32_t millis();
+uint32_t micros();
+void yield();
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef IEC62056_MQTT_HOST_HARDWARESERIAL_H
+#define IEC62056_MQTT_HOST_HARDWARESERIAL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* Same values as in the ESP8266 core, so that they can be compared to captures */
+enum SerialConfig
+{
+	SERIAL_7E1 = 0x1a,
+	SERIAL_8N1 = 0x1c,
+};
+
+enum SerialMode
+{
+	SERIAL_FULL = 0,
+	SERIAL_RX_ONLY = 1,
+	SERIAL_TX_ONLY = 2,
+};
+
+/* The subset of the ESP8266 core's HardwareSerial used by the reader. The methods are
+ * implemented by each tool. */
+class HardwareSerial
+{
+public:
+	void begin(unsigned long baud, SerialConfig config = SERIAL_8N1, SerialMode mode = SERIAL_FULL);
+	size_t write(uint8_t const *data, size_t length);
+	void flush();
+
+	int available();
+	int read();
+	size_t readBytes(uint8_t *buffer, size_t length);
+
+	bool hasRxError();
+	bool hasOverrun();
+};
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef IEC62056_MQTT_HOST_CONFIG_H
+#define IEC62056_MQTT_HOST_CONFIG_H
+
+/* Host tools use the example configuration, unless there's a src/config.h */
+#include "../../src/example_config.h"
+
+#endif
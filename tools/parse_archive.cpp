@@ -0,0 +1,192 @@
+/* Parses archives of raw data readouts (see archive.h) on all cores and writes every object
+ * as a column: one file per OBIS code with a line "frame<TAB>value" for every frame that
+ * passed the checksum, in the order of the archives. Frames are numbered across all archives;
+ * frames.tsv lists them with their archive, offset and status. Values are exactly what the
+ * device would publish with the same configuration (host/config.h).
+ *
+ * Usage: parse_archive [-j threads] [-o directory] archive...
+ *   -j threads    number of threads (default: all cores)
+ *   -o directory  where to write the columns (default: the current directory)
+ */
+
+#include <cctype>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+struct Sample
+{
+	size_t frame; /* Index within the thread's range until merged */
+	std::string_view value;
+};
+
+/* Results for one range of an archive */
+struct Range
+{
+	size_t begin, end;
+	std::vector<archive::Frame> frames;
+	std::vector<archive::Status> statuses;
+	std::unordered_map<std::string_view, std::vector<Sample>> columns;
+};
+
+static void parse_range(char const *data, size_t size, Range &range)
+{
+	archive::find_frames(data, size, range.begin, range.end, range.frames);
+
+	std::vector<archive::Object> objects;
+	range.statuses.reserve(range.frames.size());
+	for(size_t i = 0; i < range.frames.size(); ++i)
+	{
+		archive::Frame const &frame = range.frames[i];
+		archive::Status status = archive::parse_frame(std::string_view(&data[frame.offset], frame.length), objects);
+		range.statuses.push_back(status);
+		if(status != archive::Status::Ok) continue;
+
+		for(archive::Object const &object : objects)
+			range.columns[object.obis].push_back({i, object.value});
+	}
+}
+
+/* OBIS codes can contain characters that are awkward in file names, such as '*' and ':' */
+static std::string file_name(std::string_view obis)
+{
+	std::string name(obis);
+	for(char &c : name)
+	{
+		if(!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-') c = '_';
+	}
+	return name + ".tsv";
+}
+
+static FILE *open_output(std::string const &directory, std::string const &name)
+{
+	std::string path = directory + "/" + name;
+	FILE *f = fopen(path.c_str(), "w");
+	if(!f)
+	{
+		perror(path.c_str());
+		exit(1);
+	}
+	return f;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	std::string directory = ".";
+
+	int opt;
+	while((opt = getopt(argc, argv, "j:o:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'j': threads = atoi(optarg); break;
+			case 'o': directory = optarg; break;
+			default: fprintf(stderr, "usage: %s [-j threads] [-o directory] archive...\n", argv[0]); return 2;
+		}
+	}
+	if(optind >= argc)
+	{
+		fprintf(stderr, "usage: %s [-j threads] [-o directory] archive...\n", argv[0]);
+		return 2;
+	}
+	if(!threads) threads = 1;
+
+	/* The values point into the mapped archives, which therefore stay mapped until the end */
+	std::map<std::string, std::vector<Sample>> columns;
+	FILE *frames_file = open_output(directory, "frames.tsv");
+	size_t frame_count = 0, counts[3] = {}, total_bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for(int arg = optind; arg < argc; ++arg)
+	{
+		char const *path = argv[arg];
+		int fd = open(path, O_RDONLY);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) < 0)
+		{
+			perror(path);
+			return 1;
+		}
+		size_t size = st.st_size;
+		total_bytes += size;
+		if(!size)
+		{
+			close(fd);
+			continue;
+		}
+
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(mapped == MAP_FAILED)
+		{
+			perror(path);
+			return 1;
+		}
+		madvise(mapped, size, MADV_SEQUENTIAL);
+		char const *data = static_cast<char const *>(mapped);
+
+		/* Every thread takes the frames that start in its range */
+		std::vector<Range> ranges(threads);
+		std::vector<std::thread> workers;
+		for(unsigned i = 0; i < threads; ++i)
+		{
+			ranges[i].begin = size * i / threads;
+			ranges[i].end = size * (i + 1) / threads;
+			workers.emplace_back(parse_range, data, size, std::ref(ranges[i]));
+		}
+		for(std::thread &worker : workers)
+			worker.join();
+
+		for(Range const &range : ranges)
+		{
+			for(size_t i = 0; i < range.frames.size(); ++i)
+			{
+				archive::Status status = range.statuses[i];
+				static char const *const STATUS_NAMES[] = {"ok", "protocol_error", "checksum_error"};
+				fprintf(frames_file, "%zu\t%s\t%zu\t%s\n", frame_count + i, path, range.frames[i].offset,
+				        STATUS_NAMES[static_cast<size_t>(status)]);
+				++counts[static_cast<size_t>(status)];
+			}
+			for(auto const &[obis, samples] : range.columns)
+			{
+				std::vector<Sample> &column = columns[std::string(obis)];
+				for(Sample const &sample : samples)
+					column.push_back({frame_count + sample.frame, sample.value});
+			}
+			frame_count += range.frames.size();
+		}
+	}
+	fclose(frames_file);
+
+	for(auto const &[obis, samples] : columns)
+	{
+		FILE *f = open_output(directory, file_name(obis));
+		for(Sample const &sample : samples)
+			fprintf(f, "%zu\t%.*s\n", sample.frame, static_cast<int>(sample.value.size()), sample.value.data());
+		fclose(f);
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%zu frames: %zu ok, %zu protocol errors, %zu checksum errors\n", frame_count,
+	       counts[static_cast<size_t>(archive::Status::Ok)], counts[static_cast<size_t>(archive::Status::ProtocolError)],
+	       counts[static_cast<size_t>(archive::Status::ChecksumError)]);
+	printf("%zu objects, %zu bytes in %.3fs (%.1f MB/s, %u threads)\n", columns.size(), total_bytes, seconds,
+	       total_bytes / seconds / 1e6, threads);
+	return 0;
+}
@@ -0,0 +1,335 @@
+/* Replays a serial capture (see src/capture.h) through MeterReader, with the original
+ * timing or faster, to reproduce and profile problems seen in the field.
+ *
+ * Usage: replay [-s speed] [-v] [-o obis]... [-r size] capture.bin
+ *   -s speed  replay at `speed` times the original pace; 0 (the default) doesn't wait at all
+ *   -v        print the reader's log messages
+ *   -o obis   monitor this object instead of EXPORT_OBJECTS (can be repeated)
+ *   -r size   receive through an RX ring of this size (a power of two), like RX_RING_SIZE
+ *
+ * A capture can be obtained by sending "capture" to the command topic, e.g.
+ *   mosquitto_sub -C 1 -t elec/capture > capture.bin & mosquitto_pub -t elec/cmd -m capture
+ */
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "capture.h"
+#include "config.h"
+#include "logger.h"
+#include "meter.h"
+#include "rx_ring.h"
+
+struct Event
+{
+	Capture::Record type;
+	uint64_t time_us;
+	std::vector<uint8_t> data; /* Rx, Tx */
+	uint32_t baud;             /* Baud */
+	uint8_t config, mode;      /* Baud */
+};
+
+struct RxByte
+{
+	uint64_t time_us; /* When it becomes available */
+	uint8_t value;
+};
+
+static std::vector<Event> events;
+static std::vector<RxByte> rx;
+static size_t rx_pos, next_tx, next_baud;
+static size_t mismatches;
+
+static uint64_t now_us;
+static double speed;
+static RxRing *rx_ring;
+
+/* Move the virtual clock forward, sleeping if replaying in real time */
+static void advance_to(uint64_t time_us)
+{
+	if(time_us <= now_us) return;
+
+	if(speed > 0)
+		std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>((time_us - now_us) / speed)));
+	now_us = time_us;
+}
+
+uint32_t millis()
+{
+	return now_us / 1000;
+}
+
+/* Stands in for the UART interrupt: moves the bytes that have arrived into the RX ring */
+static void feed_rx_ring()
+{
+	while(rx_ring && rx_pos < rx.size() && rx[rx_pos].time_us <= now_us)
+	{
+		rx_ring->push(rx[rx_pos].value, 0, rx[rx_pos].time_us);
+		++rx_pos;
+	}
+}
+
+uint32_t micros()
+{
+	feed_rx_ring();
+	return now_us;
+}
+
+/* Called while the reader waits for data: skip ahead to the next byte, 1 ms at most */
+void yield()
+{
+	uint64_t next = now_us + 1000;
+	if(rx_pos < rx.size() && rx[rx_pos].time_us < next) next = rx[rx_pos].time_us;
+	advance_to(next);
+}
+
+static Event const *next_event(Capture::Record type, size_t &index)
+{
+	while(index < events.size() && events[index].type != type)
+	{
+		++index;
+	}
+	return index < events.size() ? &events[index++] : nullptr;
+}
+
+void HardwareSerial::begin(unsigned long baud, SerialConfig config, SerialMode mode)
+{
+	Event const *event = next_event(Capture::Record::Baud, next_baud);
+	if(!event || event->baud != baud || event->config != config || event->mode != mode)
+	{
+		printf("%10.3f ms: begin(%lu, %02x, %u) differs from the capture\n", now_us / 1e3, baud, config, mode);
+		++mismatches;
+	}
+}
+
+size_t HardwareSerial::write(uint8_t const *data, size_t length)
+{
+	Event const *event = next_event(Capture::Record::Tx, next_tx);
+	if(!event || event->data.size() != length || memcmp(event->data.data(), data, length))
+	{
+		printf("%10.3f ms: sent %zu bytes that differ from the capture\n", now_us / 1e3, length);
+		++mismatches;
+	}
+	else
+	{
+		advance_to(event->time_us); /* The original might have been waiting for something else */
+	}
+
+	return length;
+}
+
+void HardwareSerial::flush() {}
+
+int HardwareSerial::available()
+{
+	size_t count = 0;
+	while(rx_pos + count < rx.size() && rx[rx_pos + count].time_us <= now_us)
+	{
+		++count;
+	}
+	return count;
+}
+
+int HardwareSerial::read()
+{
+	if(rx_pos >= rx.size() || rx[rx_pos].time_us > now_us) return -1;
+	return rx[rx_pos++].value;
+}
+
+/* Like Stream::readBytes, with SERIAL_TIMEOUT between bytes */
+size_t HardwareSerial::readBytes(uint8_t *buffer, size_t length)
+{
+	size_t len = 0;
+	while(len < length)
+	{
+		int c = read();
+		if(c >= 0)
+		{
+			buffer[len++] = c;
+			continue;
+		}
+
+		uint64_t deadline = now_us + SERIAL_TIMEOUT * 1000;
+		if(rx_pos >= rx.size() || rx[rx_pos].time_us > deadline)
+		{
+			advance_to(deadline);
+			break;
+		}
+		advance_to(rx[rx_pos].time_us);
+	}
+
+	return len;
+}
+
+bool HardwareSerial::hasRxError()
+{
+	return false;
+}
+
+bool HardwareSerial::hasOverrun()
+{
+	return false;
+}
+
+static bool read_varint(std::vector<uint8_t> const &file, size_t &pos, uint32_t &value)
+{
+	value = 0;
+	for(unsigned shift = 0; pos < file.size() && shift < 35; shift += 7)
+	{
+		uint8_t byte = file[pos++];
+		value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+		if(!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+static bool load_capture(char const *path)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	if(file.size() < Capture::HEADER_LENGTH || memcmp(file.data(), "IECC", 4) || file[4] != Capture::VERSION)
+	{
+		fprintf(stderr, "%s: not a capture (version %u)\n", path, Capture::VERSION);
+		return false;
+	}
+	if(file[5] & Capture::FLAG_TRUNCATED) printf("warning: the capture is truncated\n");
+
+	uint64_t time_us = 0;
+	size_t pos = Capture::HEADER_LENGTH;
+	while(pos < file.size())
+	{
+		Event event = {};
+		uint32_t delta, length;
+		event.type = static_cast<Capture::Record>(file[pos++]);
+		if(!read_varint(file, pos, delta)) break;
+		event.time_us = time_us += delta;
+
+		if(event.type == Capture::Record::Rx || event.type == Capture::Record::Tx)
+		{
+			if(!read_varint(file, pos, length) || pos + length > file.size()) break;
+			event.data.assign(&file[pos], &file[pos + length]);
+			pos += length;
+
+			if(event.type == Capture::Record::Rx)
+			{
+				for(uint8_t byte : event.data)
+				{
+					rx.push_back({event.time_us, byte});
+				}
+			}
+		}
+		else if(event.type == Capture::Record::Baud)
+		{
+			if(!read_varint(file, pos, event.baud) || pos + 2 > file.size()) break;
+			event.config = file[pos++];
+			event.mode = file[pos++];
+		}
+		else
+		{
+			fprintf(stderr, "%s: unknown record type %u\n", path, static_cast<unsigned>(event.type));
+			return false;
+		}
+
+		events.push_back(std::move(event));
+	}
+
+	if(pos != file.size())
+	{
+		fprintf(stderr, "%s: truncated record at offset %zu\n", path, pos);
+		return false;
+	}
+
+	return true;
+}
+
+static void usage(char const *name)
+{
+	fprintf(stderr, "usage: %s [-s speed] [-v] [-o obis]... [-r size] capture.bin\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> objects;
+	size_t rx_ring_size = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "s:vo:r:")) != -1)
+	{
+		switch(opt)
+		{
+			case 's':
+				speed = atof(optarg);
+				break;
+			case 'v':
+				logger::set_message_sink([](char const *level, char const *message) {
+					printf("%10.3f ms: %s: %s\n", now_us / 1e3, level, message);
+				});
+				logger::set_level(logger::Level::Debug);
+				break;
+			case 'o':
+				objects.push_back(optarg);
+				break;
+			case 'r':
+				rx_ring_size = strtoul(optarg, nullptr, 0);
+				if(!rx_ring_size || (rx_ring_size & (rx_ring_size - 1))) usage(argv[0]);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(optind != argc - 1) usage(argv[0]);
+	if(!load_capture(argv[optind])) return 1;
+
+	HardwareSerial serial;
+	MeterReader reader(serial);
+	std::vector<uint8_t> rx_ring_data(rx_ring_size), rx_ring_flags(rx_ring_size);
+	RxRing ring(rx_ring_data.data(), rx_ring_flags.data(), rx_ring_size);
+	if(rx_ring_size)
+	{
+		rx_ring = &ring;
+		reader.set_rx_ring(rx_ring, 0);
+	}
+	if(objects.empty()) objects.assign(std::begin(EXPORT_OBJECTS), std::end(EXPORT_OBJECTS));
+	for(auto const &obis : objects)
+	{
+		reader.start_monitoring(obis);
+	}
+
+	auto cpu_start = std::chrono::steady_clock::now();
+	reader.start_reading();
+	while(reader.status() == MeterReader::Status::Busy)
+	{
+		reader.loop();
+		if(reader.wait_ms()) yield(); /* Stands in for the scheduler's sleep */
+	}
+	auto cpu_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpu_start);
+
+	static char const *const STATUS_NAMES[] = {"ready", "busy", "ok", "protocol error", "checksum error"};
+	MeterReader::Trace const &trace = reader.trace();
+	printf("status: %s\n", STATUS_NAMES[static_cast<size_t>(reader.status())]);
+	printf("duration: %.3f ms (first byte at %.3f ms), replay took %.3f ms\n", now_us / 1e3,
+	       (trace.first_byte - trace.request_sent) / 1e3, cpu_time.count());
+	printf("received %zu of %zu bytes, %zu mismatches\n", rx_pos, rx.size(), mismatches);
+	if(rx_ring)
+	{
+		printf("rx ring: %" PRIu32 " overruns, high water %" PRIu32 " bytes, %zu bytes left\n",
+		       ring.stats().overruns, ring.stats().high_water, ring.available());
+	}
+	for(auto const &entry : reader.values())
+	{
+		printf("%s = %s\n", entry.first.c_str(), entry.second.c_str());
+	}
+
+	return reader.status() == MeterReader::Status::Ok && !mismatches ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/* Checks archive::find_frames() and archive::parse_frame() (tools/archive.cpp) on synthetic
+ * archives: complete, corrupted and truncated frames, and every split into two ranges.
+ *
+ * Usage: test_archive
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "archive.h"
+#include "lexer.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+	do                                                                              \
+	{                                                                               \
+		if(!(condition))                                                            \
+		{                                                                           \
+			fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			++failures;                                                             \
+		}                                                                           \
+	} while(0)
+
+/* A frame as a meter sends it, with the correct BCC */
+static std::string frame(std::string const &identification, std::string const &lines)
+{
+	std::string data = lines + "!\r\n" + lexer::ETX;
+	uint8_t bcc = 0;
+	for(char c : data)
+		bcc ^= c;
+	return "/" + identification + "\r\n" + lexer::STX + data + static_cast<char>(bcc);
+}
+
+static std::vector<archive::Frame> find(std::string const &data, size_t begin, size_t end)
+{
+	std::vector<archive::Frame> frames;
+	archive::find_frames(data.data(), data.size(), begin, end, frames);
+	return frames;
+}
+
+static std::vector<archive::Frame> find(std::string const &data)
+{
+	return find(data, 0, data.size());
+}
+
+static archive::Status parse(std::string const &data, archive::Frame const &frame,
+                             std::vector<archive::Object> &objects)
+{
+	return archive::parse_frame(std::string_view(&data[frame.offset], frame.length), objects);
+}
+
+std::string const FIRST = frame("ABC5METER", "1.8.0(0001.234)\r\n2.8.0(0000.500)\r\n");
+std::string const SECOND = frame("XYZ6OTHER", "1.8.0(0001.240)\r\nC.1.0(12345678)\r\n");
+
+static void test_complete()
+{
+	std::string data = FIRST + SECOND;
+	std::vector<archive::Frame> frames = find(data);
+	CHECK(frames.size() == 2);
+	if(frames.size() != 2) return;
+	CHECK(frames[0].offset == 0 && frames[0].length == FIRST.size());
+	CHECK(frames[1].offset == FIRST.size() && frames[1].length == SECOND.size());
+
+	std::vector<archive::Object> objects;
+	CHECK(parse(data, frames[0], objects) == archive::Status::Ok);
+	CHECK(objects.size() == 2);
+	if(objects.size() == 2)
+	{
+		CHECK(objects[0].obis == "1.8.0" && objects[0].value == "0001.234");
+		CHECK(objects[1].obis == "2.8.0" && objects[1].value == "0000.500");
+	}
+	CHECK(parse(data, frames[1], objects) == archive::Status::Ok);
+	CHECK(objects.size() == 2);
+}
+
+static void test_corrupted()
+{
+	/* A bit flip in a value */
+	std::string data = FIRST;
+	data[data.find("1.234")] ^= 0x08;
+	std::vector<archive::Frame> frames = find(data);
+	std::vector<archive::Object> objects;
+	CHECK(frames.size() == 1);
+	if(frames.size() == 1) CHECK(parse(data, frames[0], objects) == archive::Status::ChecksumError);
+
+	/* An identification that is too short */
+	data = frame("AB", "1.8.0(0001.234)\r\n");
+	frames = find(data);
+	CHECK(frames.size() == 1);
+	if(frames.size() == 1) CHECK(parse(data, frames[0], objects) == archive::Status::ProtocolError);
+
+	/* Garbage between frames is skipped, '/' in it doesn't start a frame */
+	data = FIRST + "noise / more noise" + SECOND;
+	frames = find(data);
+	CHECK(frames.size() == 2);
+	if(frames.size() == 2) CHECK(frames[1].offset == data.size() - SECOND.size());
+}
+
+static void test_truncated()
+{
+	/* Cut off mid-line: the next frame's identification doesn't start a line */
+	std::string data = FIRST.substr(0, FIRST.find("2.8.0") + 8) + SECOND;
+	std::vector<archive::Frame> frames = find(data);
+	CHECK(frames.size() == 1);
+	if(frames.size() == 1)
+		CHECK(frames[0].offset == data.size() - SECOND.size() && frames[0].length == SECOND.size());
+
+	/* Cut off before the ETX at the end of the archive */
+	data = FIRST + SECOND.substr(0, SECOND.size() - 2);
+	frames = find(data);
+	CHECK(frames.size() == 1);
+	if(frames.size() == 1) CHECK(frames[0].offset == 0);
+
+	/* Only the BCC is missing */
+	data = FIRST + SECOND.substr(0, SECOND.size() - 1);
+	CHECK(find(data).size() == 1);
+}
+
+/* However the archive is split into two ranges, together they find every frame once */
+static void test_ranges()
+{
+	std::string data = FIRST + SECOND + FIRST.substr(0, 20) + SECOND + "trailing";
+	std::vector<archive::Frame> whole = find(data);
+	CHECK(whole.size() == 3);
+
+	for(size_t split = 0; split <= data.size(); ++split)
+	{
+		std::vector<archive::Frame> frames = find(data, 0, split);
+		std::vector<archive::Frame> second = find(data, split, data.size());
+		frames.insert(frames.end(), second.begin(), second.end());
+
+		bool same = frames.size() == whole.size();
+		for(size_t i = 0; same && i < frames.size(); ++i)
+			same = frames[i].offset == whole[i].offset && frames[i].length == whole[i].length;
+		if(!same)
+		{
+			fprintf(stderr, "split at %zu: %zu frames instead of %zu\n", split, frames.size(), whole.size());
+			++failures;
+		}
+	}
+}
+
+int main()
+{
+	test_complete();
+	test_corrupted();
+	test_truncated();
+	test_ranges();
+
+	if(failures)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
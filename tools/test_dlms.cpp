@@ -0,0 +1,253 @@
+/* Known-answer tests of protocol mode E (src/hdlc.cpp, src/dlms.cpp): FCS-16, HDLC frame
+ * encoding and decoding, and the AARQ, AARE and GET APDUs. The expected frames are written
+ * out byte by byte from IEC 62056-46 and -5-3; the SNRM, DISC and the AARQ frame's header
+ * are the same as in published logs of DLMS clients.
+ *
+ * Usage: test_dlms
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "dlms.h"
+#include "hdlc.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+	do                                                                              \
+	{                                                                               \
+		if(!(condition))                                                            \
+		{                                                                           \
+			fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			++failures;                                                             \
+		}                                                                           \
+	} while(0)
+
+using Bytes = std::vector<uint8_t>;
+
+static bool equal(uint8_t const *data, size_t length, Bytes const &expected)
+{
+	if(length == expected.size() && !memcmp(data, expected.data(), length)) return true;
+
+	fprintf(stderr, "got      ");
+	for(size_t i = 0; i < length; ++i)
+		fprintf(stderr, " %02x", data[i]);
+	fprintf(stderr, "\nexpected ");
+	for(uint8_t b : expected)
+		fprintf(stderr, " %02x", b);
+	fprintf(stderr, "\n");
+	return false;
+}
+
+static void test_fcs16()
+{
+	/* The check value of CRC-16/X-25 */
+	uint8_t const CHECK_INPUT[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	CHECK(hdlc::fcs16(CHECK_INPUT, sizeof(CHECK_INPUT)) == 0x906e);
+	CHECK(hdlc::fcs16(nullptr, 0) == 0x0000);
+
+	/* Over data followed by its FCS (least significant byte first), the register ends at
+	 * the good residue 0xf0b8, which fcs16() returns complemented */
+	uint8_t data[] = {0xa0, 0x07, 0x03, 0x21, 0x93, 0x00, 0x00};
+	uint16_t fcs = hdlc::fcs16(data, 5);
+	data[5] = fcs & 0xff;
+	data[6] = fcs >> 8;
+	CHECK(hdlc::fcs16(data, sizeof(data)) == static_cast<uint16_t>(~0xf0b8));
+}
+
+static void test_hdlc_encode()
+{
+	uint8_t frame[hdlc::MAX_FRAME_LENGTH];
+
+	size_t len = hdlc::encode(frame, sizeof(frame), hdlc::SNRM, nullptr, 0);
+	CHECK(equal(frame, len, {0x7e, 0xa0, 0x07, 0x03, 0x21, 0x93, 0x0f, 0x01, 0x7e}));
+	len = hdlc::encode(frame, sizeof(frame), hdlc::DISC, nullptr, 0);
+	CHECK(equal(frame, len, {0x7e, 0xa0, 0x07, 0x03, 0x21, 0x53, 0x03, 0xc7, 0x7e}));
+
+	/* The first information frame carries the AARQ: format and length, addresses, control
+	 * (send and receive sequence 0), HCS, LLC header, APDU, FCS */
+	uint8_t apdu[64];
+	memcpy(apdu, dlms::LLC_REQUEST, sizeof(dlms::LLC_REQUEST));
+	size_t apdu_len = sizeof(dlms::LLC_REQUEST);
+	apdu_len += dlms::encode_aarq(&apdu[apdu_len], sizeof(apdu) - apdu_len);
+	len = hdlc::encode(frame, sizeof(frame), hdlc::information_control(0, 0), apdu, apdu_len);
+	CHECK(len == 2 + 0x2b);
+	CHECK(equal(frame, 8, {0x7e, 0xa0, 0x2b, 0x03, 0x21, 0x10, 0xfb, 0xaf}));
+	CHECK(equal(&frame[8], len - 11, Bytes(apdu, apdu + apdu_len)));
+	CHECK(frame[len - 1] == hdlc::FLAG);
+	uint16_t fcs = hdlc::fcs16(&frame[1], len - 4);
+	CHECK(frame[len - 3] == (fcs & 0xff) && frame[len - 2] == fcs >> 8);
+
+	/* Sequence numbers wrap around at 8 */
+	CHECK(hdlc::information_control(1, 0) == 0x12);
+	CHECK(hdlc::information_control(0, 1) == 0x30);
+	CHECK(hdlc::information_control(7, 7) == 0xfe);
+	CHECK(hdlc::information_control(8, 8) == 0x10);
+
+	/* Information fields longer than the default maximum aren't supported */
+	uint8_t large[hdlc::MAX_INFORMATION_LENGTH + 1] = {};
+	CHECK(hdlc::encode(frame, sizeof(frame), hdlc::information_control(0, 0), large, sizeof(large)) == 0);
+	CHECK(hdlc::encode(frame, sizeof(frame), hdlc::information_control(0, 0), large, sizeof(large) - 1) ==
+	      hdlc::MAX_FRAME_LENGTH);
+	CHECK(hdlc::encode(frame, 8, hdlc::SNRM, nullptr, 0) == 0);
+}
+
+static void test_hdlc_decode()
+{
+	hdlc::Frame decoded;
+
+	/* UA to the SNRM, without parameters */
+	uint8_t const UA[] = {0x7e, 0xa0, 0x07, 0x21, 0x03, 0x73, 0x00, 0x00, 0x7e};
+	uint8_t ua[sizeof(UA)];
+	memcpy(ua, UA, sizeof(UA));
+	uint16_t fcs = hdlc::fcs16(&ua[1], 5);
+	ua[6] = fcs & 0xff;
+	ua[7] = fcs >> 8;
+	CHECK(hdlc::frame_length(ua) == sizeof(ua));
+	CHECK(hdlc::decode(ua, sizeof(ua), decoded) == hdlc::Result::Ok);
+	CHECK(decoded.destination == hdlc::CLIENT_ADDRESS && decoded.source == hdlc::SERVER_ADDRESS);
+	CHECK(decoded.control == hdlc::UA && decoded.length == 0);
+
+	/* An information frame from the server decodes to the information that was encoded */
+	uint8_t frame[hdlc::MAX_FRAME_LENGTH];
+	uint8_t const INFORMATION[] = {0xe6, 0xe7, 0x00, 0xc4, 0x01, 0xc1, 0x00, 0x06, 0x00, 0x00, 0x12, 0x34};
+	size_t len = hdlc::encode(frame, sizeof(frame), hdlc::information_control(0, 1), INFORMATION,
+	                          sizeof(INFORMATION));
+	CHECK(hdlc::frame_length(frame) == len);
+	CHECK(hdlc::decode(frame, len, decoded) == hdlc::Result::Ok);
+	CHECK(hdlc::is_information(decoded.control));
+	CHECK(equal(decoded.information, decoded.length, Bytes(INFORMATION, INFORMATION + sizeof(INFORMATION))));
+
+	/* Every single bit flip between the flags is caught */
+	bool all_caught = true;
+	for(size_t i = 3; i < len - 1; ++i)
+	{
+		for(unsigned bit = 0; bit < 8; ++bit)
+		{
+			frame[i] ^= 1 << bit;
+			all_caught &= hdlc::decode(frame, len, decoded) == hdlc::Result::BadChecksum;
+			frame[i] ^= 1 << bit;
+		}
+	}
+	CHECK(all_caught);
+
+	/* Truncated, missing the closing flag, or another frame type */
+	CHECK(hdlc::decode(frame, len - 1, decoded) == hdlc::Result::BadFormat);
+	frame[len - 1] = 0;
+	CHECK(hdlc::decode(frame, len, decoded) == hdlc::Result::BadFormat);
+	frame[len - 1] = hdlc::FLAG;
+	frame[1] = 0x90;
+	CHECK(hdlc::frame_length(frame) == 0);
+
+	/* Segmented frames (the S bit of the format field) aren't supported */
+	frame[1] = 0xa8;
+	CHECK(hdlc::frame_length(frame) == 0);
+	CHECK(hdlc::decode(frame, len, decoded) == hdlc::Result::BadFormat);
+}
+
+static void test_aarq_aare()
+{
+	uint8_t apdu[64];
+	size_t len = dlms::encode_aarq(apdu, sizeof(apdu));
+	CHECK(equal(apdu, len,
+	            {
+	                0x60, 0x1d,                                                       /* AARQ */
+	                0xa1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01, /* LN, no ciphering */
+	                0xbe, 0x10, 0x04, 0x0e,                                           /* user-information */
+	                0x01, 0x00, 0x00, 0x00, 0x06,                                     /* InitiateRequest, version 6 */
+	                0x5f, 0x1f, 0x04, 0x00, 0x00, 0x00, 0x10,                         /* conformance: get */
+	                0x00, 0x7d,                                                       /* max receive PDU size */
+	            }));
+	CHECK(dlms::encode_aarq(apdu, len - 1) == 0);
+
+	/* AARE accepting the association, then the same with result rejected-permanent */
+	uint8_t aare[] = {
+	    0x61, 0x29,                                                       /* AARE */
+	    0xa1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01, /* application-context-name */
+	    0xa2, 0x03, 0x02, 0x01, 0x00,                                     /* result: accepted */
+	    0xa3, 0x05, 0xa1, 0x03, 0x02, 0x01, 0x00,                         /* result-source-diagnostic */
+	    0xbe, 0x10, 0x04, 0x0e, 0x08, 0x00, 0x06, 0x5f, 0x1f, 0x04,       /* InitiateResponse */
+	    0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x07,
+	};
+	CHECK(dlms::aare_accepted(aare, sizeof(aare)));
+	aare[17] = 0x01;
+	CHECK(!dlms::aare_accepted(aare, sizeof(aare)));
+	aare[17] = 0x00;
+	CHECK(!dlms::aare_accepted(aare, sizeof(aare) - 1)); /* Shorter than its length */
+	aare[0] = 0x60;
+	CHECK(!dlms::aare_accepted(aare, sizeof(aare)));
+}
+
+static void test_get()
+{
+	uint8_t obis[6];
+	CHECK(dlms::parse_obis("1.8.0", obis));
+	CHECK(equal(obis, 6, {1, 0, 1, 8, 0, 255}));
+	CHECK(dlms::parse_obis("0-0:96.1.0*255", obis));
+	CHECK(equal(obis, 6, {0, 0, 96, 1, 0, 255}));
+	CHECK(!dlms::parse_obis("C.1.0", obis));
+	CHECK(!dlms::parse_obis("1.8.256", obis));
+
+	uint8_t apdu[16];
+	dlms::parse_obis("1.8.0", obis);
+	size_t len = dlms::encode_get_request(apdu, sizeof(apdu), dlms::REGISTER_CLASS, obis, dlms::REGISTER_VALUE);
+	CHECK(equal(apdu, len,
+	            {
+	                0xc0, 0x01, 0xc1,                   /* GET.request.normal, invoke id 1 */
+	                0x00, 0x03,                         /* Register */
+	                0x01, 0x00, 0x01, 0x08, 0x00, 0xff, /* 1-0:1.8.0*255 */
+	                0x02,                               /* value */
+	                0x00,                               /* no selective access */
+	            }));
+
+	dlms::Data data;
+	uint8_t const DOUBLE_LONG_UNSIGNED[] = {0xc4, 0x01, 0xc1, 0x00, 0x06, 0x00, 0x01, 0xe2, 0x40};
+	CHECK(dlms::parse_get_response(DOUBLE_LONG_UNSIGNED, sizeof(DOUBLE_LONG_UNSIGNED), data) ==
+	      dlms::GetResult::Ok);
+	CHECK(data.type == dlms::Data::Type::Integer && data.integer == 123456);
+
+	uint8_t const LONG[] = {0xc4, 0x01, 0xc1, 0x00, 0x10, 0xff, 0x38};
+	CHECK(dlms::parse_get_response(LONG, sizeof(LONG), data) == dlms::GetResult::Ok);
+	CHECK(data.type == dlms::Data::Type::Integer && data.integer == -200);
+
+	uint8_t const SCALER_UNIT[] = {0xc4, 0x01, 0xc1, 0x00, 0x02, 0x02, 0x0f, 0xfe, 0x16, 0x1e};
+	CHECK(dlms::parse_get_response(SCALER_UNIT, sizeof(SCALER_UNIT), data) == dlms::GetResult::Ok);
+	CHECK(data.type == dlms::Data::Type::ScalerUnit && data.scaler == -2 && data.unit == 30);
+
+	uint8_t const OCTET_STRING[] = {0xc4, 0x01, 0xc1, 0x00, 0x09, 0x03, 'A', 'B', 'C'};
+	CHECK(dlms::parse_get_response(OCTET_STRING, sizeof(OCTET_STRING), data) == dlms::GetResult::Ok);
+	CHECK(data.type == dlms::Data::Type::String && data.string == "ABC");
+
+	uint8_t const OBJECT_UNDEFINED[] = {0xc4, 0x01, 0xc1, 0x01, 0x04};
+	CHECK(dlms::parse_get_response(OBJECT_UNDEFINED, sizeof(OBJECT_UNDEFINED), data) ==
+	      dlms::GetResult::AccessError);
+	CHECK(dlms::parse_get_response(DOUBLE_LONG_UNSIGNED, sizeof(DOUBLE_LONG_UNSIGNED) - 1, data) ==
+	      dlms::GetResult::Malformed);
+
+	char text[32];
+	dlms::format_value(text, sizeof(text), 123456, -2, 30);
+	CHECK(!strcmp(text, "1234.56*Wh"));
+	dlms::format_value(text, sizeof(text), -5, -3, 27);
+	CHECK(!strcmp(text, "-0.005*W"));
+	dlms::format_value(text, sizeof(text), 12, 2, dlms::NO_UNIT);
+	CHECK(!strcmp(text, "1200"));
+}
+
+int main()
+{
+	test_fcs16();
+	test_hdlc_encode();
+	test_hdlc_decode();
+	test_aarq_aare();
+	test_get();
+
+	if(failures)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,126 @@
+/* Feeds synthetic pulse trains through PulseEstimator (src/pulse.cpp) and checks the
+ * debounce filter, the power estimate and the calibration of the meter constant.
+ *
+ * Usage: test_pulse
+ */
+
+#include <cstdio>
+#include <optional>
+
+#include "pulse.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+	do                                                                              \
+	{                                                                               \
+		if(!(condition))                                                            \
+		{                                                                           \
+			fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			++failures;                                                             \
+		}                                                                           \
+	} while(0)
+
+uint32_t const IMP_PER_KWH = 1000;
+uint32_t const DEBOUNCE = 20000; /* us */
+
+/* Power in whole W, or -1 if there is no estimate */
+static int64_t watts(PulseEstimator const &estimator, uint32_t now_us)
+{
+	std::optional<Fixed> power = estimator.power(now_us);
+	return power ? *power / FIXED_ONE : -1;
+}
+
+/* Pulses of a meter that actually gives imp_per_kwh, at a constant power, starting at
+ * start_us. Returns when the next pulse would be due. */
+static uint32_t pulse_train(PulseEstimator &estimator, uint32_t start_us, uint32_t count, uint32_t imp_per_kwh,
+                            uint32_t power_w)
+{
+	uint32_t interval = static_cast<uint64_t>(3600000000000) / (static_cast<uint64_t>(imp_per_kwh) * power_w);
+	uint32_t t = start_us;
+	for(uint32_t i = 0; i < count; ++i, t += interval)
+		estimator.pulse(t);
+	return t;
+}
+
+static void test_debounce()
+{
+	PulseEstimator estimator(IMP_PER_KWH, DEBOUNCE);
+	CHECK(estimator.pulse(1000000));
+	CHECK(!estimator.pulse(1000000 + DEBOUNCE - 1)); /* Contact bounce */
+	CHECK(!estimator.pulse(1000000 + 5000));
+	CHECK(estimator.pulse(1000000 + DEBOUNCE));
+	CHECK(estimator.pulses() == 2);
+	CHECK(estimator.rejected() == 2);
+	/* The rejected pulses don't shorten the interval: 20 ms at 1000 imp/kWh is 180 kW */
+	CHECK(watts(estimator, 1000000 + DEBOUNCE) == 180000);
+}
+
+static void test_power()
+{
+	PulseEstimator estimator(IMP_PER_KWH, DEBOUNCE);
+	CHECK(watts(estimator, 0) == -1);
+	estimator.pulse(0);
+	CHECK(watts(estimator, 1000) == -1); /* Needs an interval */
+
+	/* 1 kW is one pulse every 3.6 s */
+	uint32_t next = pulse_train(estimator, 3600000, 10, IMP_PER_KWH, 1000);
+	CHECK(watts(estimator, next - 3600000) == 1000);
+	CHECK(watts(estimator, next) == 1000);
+	/* No pulse for twice the interval: at most half the power */
+	CHECK(watts(estimator, next + 3600000) == 500);
+
+	/* Across the wraparound of micros() */
+	PulseEstimator wrapping(IMP_PER_KWH, DEBOUNCE);
+	next = pulse_train(wrapping, UINT32_MAX - 4000000, 4, IMP_PER_KWH, 2000);
+	CHECK(next < 4000000);
+	CHECK(watts(wrapping, next) == 2000);
+}
+
+static void test_calibration()
+{
+	/* The meter actually gives 5% more pulses than configured */
+	PulseEstimator estimator(IMP_PER_KWH, DEBOUNCE);
+	estimator.calibrate(0); /* Reference */
+	uint32_t next = pulse_train(estimator, 0, 500, 1050, 3000);
+	estimator.calibrate(500 * FIXED_ONE / 1050);
+	CHECK(estimator.correction() == FIXED_ONE); /* Fewer than MIN_CALIBRATION_PULSES, kept the reference */
+
+	next = pulse_train(estimator, next, 550, 1050, 3000);
+	estimator.calibrate(FIXED_ONE); /* 1050 pulses for 1 kWh */
+	CHECK(estimator.correction() == FIXED_ONE * 105 / 100);
+	CHECK(watts(estimator, next) == 3000); /* Corrected */
+
+	/* A correction of 20% is assumed to be a missed readout and ignored */
+	PulseEstimator missed(IMP_PER_KWH, DEBOUNCE);
+	missed.calibrate(0);
+	pulse_train(missed, 0, 1200, 1000, 3000);
+	missed.calibrate(FIXED_ONE);
+	CHECK(missed.correction() == FIXED_ONE);
+	/* But the reference moved on, the next period is judged on its own */
+	pulse_train(missed, 2000000000, 1020, 1020, 3000);
+	missed.calibrate(2 * FIXED_ONE);
+	CHECK(missed.correction() == FIXED_ONE * 102 / 100);
+
+	/* Without a change of the register there's nothing to compare with */
+	PulseEstimator unchanged(IMP_PER_KWH, DEBOUNCE);
+	unchanged.calibrate(FIXED_ONE);
+	pulse_train(unchanged, 0, 1000, 1000, 3000);
+	unchanged.calibrate(FIXED_ONE);
+	CHECK(unchanged.correction() == FIXED_ONE);
+}
+
+int main()
+{
+	test_debounce();
+	test_power();
+	test_calibration();
+
+	if(failures)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
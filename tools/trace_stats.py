@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Summarize readout latency traces published with PUBLISH_TRACE.
+
+Reads `topic payload` lines as printed by `mosquitto_sub -v`, for example:
+
+    mosquitto_sub -h broker -v -t '+/trace' | tools/trace_stats.py
+
+and prints latency percentiles and sequence gaps per device when the input
+ends (or on Ctrl-C).
+"""
+
+import json
+import sys
+from collections import defaultdict
+
+TRACE_SUFFIX = "/trace"
+
+# Name, start milestone, end milestone
+PHASES = [
+    ("first byte", "req", "first"),
+    ("data block", "first", "bcc"),
+    ("to publish", "bcc", "enq"),
+    ("publish", "enq", "sent"),
+    ("total", "req", "sent"),
+]
+
+
+class Device:
+    def __init__(self):
+        self.latencies = defaultdict(list)
+        self.last_seq = None
+        self.received = 0
+        self.missed = 0
+        self.restarts = 0
+
+    def add(self, trace):
+        seq = trace["seq"]
+        if self.last_seq is not None:
+            if seq <= self.last_seq:
+                self.restarts += 1  # Sequence numbers restart when the device reboots
+            elif seq > self.last_seq + 1:
+                self.missed += seq - self.last_seq - 1
+        self.last_seq = seq
+        self.received += 1
+
+        times = dict(trace)
+        times["req"] = 0  # Everything else is relative to the request
+        for name, start, end in PHASES:
+            if times.get(start) is not None and times.get(end) is not None:
+                self.latencies[name].append(times[end] - times[start])
+
+
+def percentile(ordered, p):
+    index = min(len(ordered) - 1, int(round(p / 100 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def report(devices, out):
+    for name in sorted(devices):
+        device = devices[name]
+        out.write(f"{name}: {device.received} readouts, {device.missed} missed, "
+                  f"{device.restarts} restarts\n")
+        out.write(f"  {'phase':<12}{'p50':>10}{'p90':>10}{'p99':>10}{'max':>10}  (ms)\n")
+        for phase, _, _ in PHASES:
+            values = sorted(device.latencies[phase])
+            if not values:
+                continue
+            columns = "".join(f"{percentile(values, p) / 1000:>10.1f}" for p in (50, 90, 99, 100))
+            out.write(f"  {phase:<12}{columns}\n")
+
+
+def main():
+    devices = defaultdict(Device)
+    try:
+        for line in sys.stdin:
+            topic, _, payload = line.strip().partition(" ")
+            if not topic.endswith(TRACE_SUFFIX):
+                continue
+            try:
+                trace = json.loads(payload)
+            except ValueError:
+                sys.stderr.write(f"ignoring malformed trace: {line}")
+                continue
+            devices[topic[: -len(TRACE_SUFFIX)]].add(trace)
+    except KeyboardInterrupt:
+        pass
+
+    report(devices, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()